@@ -0,0 +1,523 @@
+#include "classifier.h"
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Microbenchmarks for every map backend and hash function.
+//   bench [--quick] [--csv results.csv]
+// For each backend, hash function, vocabulary size, key length distribution
+// and target load factor it measures insert, hit lookup, miss lookup, loading
+// the model from CSV and classifying emails, plus scoring raw email text for
+// the word automaton and the flat map. Results are printed as a table
+// and, with --csv, written one row per measurement so runs can be compared
+// across releases. Cache misses come from perf_event_open where the kernel
+// allows it and are reported as -1 otherwise.
+
+// Last-level cache misses of this thread, read with perf_event_open
+class CacheMissCounter {
+private:
+    int fd;
+
+public:
+    CacheMissCounter() : fd(-1) {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~CacheMissCounter() {
+#ifdef __linux__
+        if (fd >= 0) {
+            close(fd);
+        }
+#endif
+    }
+
+    bool available() const { return fd >= 0; }
+
+    void start() {
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    // Misses since start(), or -1 if the counter is unavailable
+    long long stop() {
+#ifdef __linux__
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            long long misses = 0;
+            if (read(fd, &misses, sizeof(misses)) == (ssize_t)sizeof(misses)) {
+                return misses;
+            }
+        }
+#endif
+        return -1;
+    }
+};
+
+CacheMissCounter cacheMisses;
+volatile size_t benchmarkSink;      //keeps measured loops from being optimised away
+
+struct Measurement {
+    double nsPerOp;
+    double cacheMissesPerOp;        //-1 when not available
+};
+
+template <class Body>
+Measurement measure(size_t operations, Body&& body) {
+    cacheMisses.start();
+    auto start = chrono::steady_clock::now();
+    body();
+    auto end = chrono::steady_clock::now();
+    long long misses = cacheMisses.stop();
+    Measurement m;
+    m.nsPerOp = chrono::duration<double, nano>(end - start).count() / (double)operations;
+    m.cacheMissesPerOp = misses < 0 ? -1.0 : (double)misses / (double)operations;
+    return m;
+}
+
+inline uint64_t fnv1aHash(string_view key) {
+    return compiledModelHash(key.data(), key.size());
+}
+
+struct HashPolicy {
+    const char* name;
+    HashFunction function;
+};
+
+// Keys with lengths drawn from a distribution, plus emails made of them
+struct Workload {
+    string keyLengths;              //name of the length distribution
+    vector<WordFreq> words;
+    vector<string> missKeys;
+    vector<string_view> emailTokens;
+    vector<size_t> emailEnds;
+    string csvFile;                 //the words as a transposed model CSV
+    string modelFile;               //and as a compiled model
+};
+
+struct Result {
+    string backend;
+    string hash;
+    string operation;
+    size_t vocabulary;
+    string keyLengths;
+    double targetLoadFactor;        //0 when the map was left to grow on its own
+    double loadFactor;              //the one the map actually reached
+    Measurement measurement;
+};
+
+vector<Result> results;
+
+void record(const string& backend, const string& hash, const string& operation, const Workload& w,
+            double loadFactor, const Measurement& m, double targetLoadFactor = 0) {
+    Result r = {backend, hash, operation, w.words.size(), w.keyLengths, targetLoadFactor, loadFactor, m};
+    results.push_back(r);
+    cout << backend << " | " << hash << " | " << operation << " | " << w.words.size() << " words, "
+         << w.keyLengths << " keys | load " << loadFactor;
+    if (targetLoadFactor > 0) {
+        cout << " (target " << targetLoadFactor << ")";
+    }
+    cout << " | " << m.nsPerOp << " ns/op";
+    if (m.cacheMissesPerOp >= 0) {
+        cout << ", " << m.cacheMissesPerOp << " misses/op";
+    }
+    cout << endl;
+}
+
+// Random lowercase keys; each length is drawn from lengths
+vector<string> makeKeys(size_t count, const vector<int>& lengths, unsigned& random, const string& suffix) {
+    vector<string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+        random = random * 1103515245u + 12345u;
+        string key(lengths[(random >> 8) % lengths.size()], 'a');
+        for (char& c : key) {
+            random = random * 1103515245u + 12345u;
+            c = (char)('a' + (random >> 16) % 26);
+        }
+        // The index keeps keys unique without changing the length much
+        key += to_string(i) + suffix;
+        keys.push_back(key);
+    }
+    return keys;
+}
+
+Workload makeWorkload(size_t vocabulary, const string& keyLengths, const vector<int>& lengths) {
+    Workload w;
+    w.keyLengths = keyLengths;
+    unsigned random = 12345u + (unsigned)vocabulary;
+    vector<string> keys = makeKeys(vocabulary, lengths, random, "");
+    for (const string& key : keys) {
+        random = random * 1103515245u + 12345u;
+        w.words.push_back(WordFreq(key, (random >> 8) % 1000, (random >> 18) % 1000));
+    }
+    w.missKeys = makeKeys(vocabulary, lengths, random, "q");
+
+    // 2000 emails of 100 tokens, half of them model words
+    for (int e = 0; e < 2000; e++) {
+        for (int t = 0; t < 100; t++) {
+            random = random * 1103515245u + 12345u;
+            size_t pick = (random >> 8) % vocabulary;
+            w.emailTokens.push_back(t % 2 ? string_view(w.words[pick].word) : string_view(w.missKeys[pick]));
+        }
+        w.emailEnds.push_back(w.emailTokens.size());
+    }
+
+    w.csvFile = "bench_" + to_string(vocabulary) + "_" + keyLengths + ".csv";
+    w.modelFile = "bench_" + to_string(vocabulary) + "_" + keyLengths + ".model";
+    writeWordFrequenciesToTransposedCSV(w.csvFile, w.words);
+    compileModel(w.words, w.modelFile);
+    return w;
+}
+
+// A slice of the token stream that classify can iterate
+struct TokenRange {
+    const string_view* first;
+    const string_view* last;
+
+    const string_view* begin() const { return first; }
+    const string_view* end() const { return last; }
+};
+
+template <class Map>
+Measurement measureLookups(Map& map, const vector<string>& keys, size_t rounds) {
+    return measure(keys.size() * rounds, [&]() {
+        size_t found = 0;
+        for (size_t r = 0; r < rounds; r++) {
+            for (const string& key : keys) {
+                found += map.search(key) != nullptr;
+            }
+        }
+        benchmarkSink = found;
+    });
+}
+
+template <class Map>
+Measurement measureClassify(Map& map, const Workload& w) {
+    BasicEmailClassifier<Map> classifier(&map);
+    return measure(w.emailEnds.size(), [&]() {
+        size_t spam = 0, begin = 0;
+        for (size_t end : w.emailEnds) {
+            TokenRange email = {w.emailTokens.data() + begin, w.emailTokens.data() + end};
+            spam += classifier.classify(email);
+            begin = end;
+        }
+        benchmarkSink = spam;
+    });
+}
+
+// The emails as text, words joined by spaces
+vector<string> makeEmailTexts(const Workload& w) {
+    vector<string> texts;
+    size_t begin = 0;
+    for (size_t end : w.emailEnds) {
+        string text;
+        for (size_t t = begin; t < end; t++) {
+            text += w.emailTokens[t];
+            text += ' ';
+        }
+        texts.push_back(text);
+        begin = end;
+    }
+    return texts;
+}
+
+// Scores every email from its text; each is copied to a buffer first
+// because the maps' path tokenizes it in place
+template <class Map>
+Measurement measureTextScoring(Map& map, const vector<string>& texts) {
+    BasicEmailClassifier<Map> classifier(&map);
+    string buffer;
+    return measure(texts.size(), [&]() {
+        size_t spam = 0;
+        for (const string& text : texts) {
+            buffer = text;
+            spam += classifier.classifyText(&buffer[0], buffer.size());
+        }
+        benchmarkSink = spam;
+    });
+}
+
+// Rounds of lookups so that each measurement covers about a million
+size_t lookupRounds(size_t keys) {
+    return max<size_t>(1, 1000000 / keys);
+}
+
+// initialSize is the size the map is created with; the maps round it up to
+// a power of two and grow past their own limits, so the load factor actually
+// reached is what gets reported. With a target load factor, a map that ended
+// up elsewhere (it grew, or sizes itself) is skipped rather than reported as
+// another run of a configuration measured already.
+template <class Map>
+void benchMap(const string& backend, const HashPolicy& hash, const Workload& w, int initialSize,
+              double targetLoadFactor = 0) {
+    {
+        Map map(initialSize, hash.function);
+        loadWordFrequenciesFromTransposedCSV(w.csvFile, &map);
+        if (targetLoadFactor > 0 && fabs(map.getLoadFactor() - targetLoadFactor) > 0.001) {
+            cout << backend << " | " << hash.name << " | skipped at target load " << targetLoadFactor
+                 << ", reaches " << map.getLoadFactor() << endl;
+            return;
+        }
+    }
+
+    Measurement insertM;
+    {
+        Map map(initialSize, hash.function);
+        insertM = measure(w.words.size(), [&]() {
+            for (const WordFreq& wf : w.words) {
+                map.insert(wf);
+            }
+            map.finishRehash();
+        });
+    }
+
+    Map map(initialSize, hash.function);
+    Measurement loadM = measure(1, [&]() {
+        loadWordFrequenciesFromTransposedCSV(w.csvFile, &map);
+    });
+    loadM.nsPerOp /= (double)w.words.size();
+    if (loadM.cacheMissesPerOp >= 0) {
+        loadM.cacheMissesPerOp /= (double)w.words.size();
+    }
+    double loadFactor = map.getLoadFactor();
+
+    vector<string> hitKeys;
+    for (const WordFreq& wf : w.words) {
+        hitKeys.push_back(wf.word);
+    }
+    size_t rounds = lookupRounds(hitKeys.size());
+
+    record(backend, hash.name, "insert", w, loadFactor, insertM, targetLoadFactor);
+    record(backend, hash.name, "load_per_word", w, loadFactor, loadM, targetLoadFactor);
+    record(backend, hash.name, "hit", w, loadFactor, measureLookups(map, hitKeys, rounds), targetLoadFactor);
+    record(backend, hash.name, "miss", w, loadFactor, measureLookups(map, w.missKeys, rounds), targetLoadFactor);
+    record(backend, hash.name, "classify_per_email", w, loadFactor, measureClassify(map, w), targetLoadFactor);
+}
+
+// Read-only and always hashed with FNV-1a; "load" is opening the image
+void benchCompiledModel(const Workload& w) {
+    CompiledModel model;
+    Measurement openM = measure(1, [&]() {
+        model.open(w.modelFile);
+    });
+    openM.nsPerOp /= (double)w.words.size();
+    if (openM.cacheMissesPerOp >= 0) {
+        openM.cacheMissesPerOp /= (double)w.words.size();
+    }
+
+    vector<string> hitKeys;
+    for (const WordFreq& wf : w.words) {
+        hitKeys.push_back(wf.word);
+    }
+    size_t rounds = lookupRounds(hitKeys.size());
+    double loadFactor = 0.5;        //compileModel sizes the index to at least twice the words
+
+    record("Compiled", "fnv1a", "load_per_word", w, loadFactor, openM);
+    record("Compiled", "fnv1a", "hit", w, loadFactor, measureLookups(model, hitKeys, rounds));
+    record("Compiled", "fnv1a", "miss", w, loadFactor, measureLookups(model, w.missKeys, rounds));
+    record("Compiled", "fnv1a", "classify_per_email", w, loadFactor, measureClassify(model, w));
+}
+
+// Always hashed with wordHash64; the 8-bit model only rounds differently, so
+// it is not measured separately
+void benchQuantized(const Workload& w) {
+    Measurement insertM;
+    {
+        QuantizedModel model(997);
+        insertM = measure(w.words.size(), [&]() {
+            for (const WordFreq& wf : w.words) {
+                model.insert(wf);
+            }
+        });
+    }
+
+    QuantizedModel model(997);
+    Measurement loadM = measure(1, [&]() {
+        loadWordFrequenciesFromTransposedCSV(w.csvFile, &model);
+    });
+    loadM.nsPerOp /= (double)w.words.size();
+    if (loadM.cacheMissesPerOp >= 0) {
+        loadM.cacheMissesPerOp /= (double)w.words.size();
+    }
+
+    vector<string> hitKeys;
+    for (const WordFreq& wf : w.words) {
+        hitKeys.push_back(wf.word);
+    }
+    size_t rounds = lookupRounds(hitKeys.size());
+    TableStats stats = model.getStats();
+    double loadFactor = stats.loadFactor();
+
+    record("Quantized", "wordHash64", "insert", w, loadFactor, insertM);
+    record("Quantized", "wordHash64", "load_per_word", w, loadFactor, loadM);
+    record("Quantized", "wordHash64", "hit", w, loadFactor, measureLookups(model, hitKeys, rounds));
+    record("Quantized", "wordHash64", "miss", w, loadFactor, measureLookups(model, w.missKeys, rounds));
+    record("Quantized", "wordHash64", "classify_per_email", w, loadFactor, measureClassify(model, w));
+}
+
+// Hashes nothing, so it runs once per workload. "text_per_email" is the
+// text path of classify --map automaton; Flat gets the same row, tokenizing
+// and looking the words up, to compare against.
+void benchAutomaton(const Workload& w) {
+    WordAutomaton automaton(997);
+    Measurement loadM = measure(1, [&]() {
+        loadWordFrequenciesFromTransposedCSV(w.csvFile, &automaton);
+    });
+    loadM.nsPerOp /= (double)w.words.size();
+    if (loadM.cacheMissesPerOp >= 0) {
+        loadM.cacheMissesPerOp /= (double)w.words.size();
+    }
+
+    vector<string> hitKeys;
+    for (const WordFreq& wf : w.words) {
+        hitKeys.push_back(wf.word);
+    }
+    size_t rounds = lookupRounds(hitKeys.size());
+    vector<string> texts = makeEmailTexts(w);
+    double loadFactor = (double)automaton.getCount() / automaton.getStats().buckets;
+
+    record("Automaton", "none", "load_per_word", w, loadFactor, loadM);
+    record("Automaton", "none", "hit", w, loadFactor, measureLookups(automaton, hitKeys, rounds));
+    record("Automaton", "none", "miss", w, loadFactor, measureLookups(automaton, w.missKeys, rounds));
+    record("Automaton", "none", "classify_per_email", w, loadFactor, measureClassify(automaton, w));
+    record("Automaton", "none", "text_per_email", w, loadFactor, measureTextScoring(automaton, texts));
+
+    FlatHashMap flatMap(997);
+    loadWordFrequenciesFromTransposedCSV(w.csvFile, &flatMap);
+    record("Flat", "wordHash64", "text_per_email", w, flatMap.getLoadFactor(), measureTextScoring(flatMap, texts));
+}
+
+void benchAllBackends(const HashPolicy& hash, const Workload& w, int initialSize, double targetLoadFactor = 0) {
+    benchMap<ChainingHashMap>("Chaining", hash, w, initialSize, targetLoadFactor);
+    benchMap<OpenAddressingHashMap>("Open Addressing", hash, w, initialSize, targetLoadFactor);
+    benchMap<FlatHashMap>("Flat", hash, w, initialSize, targetLoadFactor);
+    // Arena Chaining never grows (it is meant to be reloaded with a model of
+    // known size), so starting it small would only measure overlong chains
+    benchMap<ArenaChainingHashMap>("Arena Chaining", hash, w, max(initialSize, (int)w.words.size()), targetLoadFactor);
+    benchMap<PrefilteredMap<ChainingHashMap>>("Chaining + Bloom", hash, w, initialSize, targetLoadFactor);
+    benchMap<PrefilteredMap<OpenAddressingHashMap>>("Open Addressing + Bloom", hash, w, initialSize, targetLoadFactor);
+    benchMap<ConcurrentHashMap>("Concurrent", hash, w, initialSize, targetLoadFactor);
+    // Sized by the words alone; "insert" includes building the index
+    benchMap<PerfectHashMap>("Perfect Hash", hash, w, initialSize, targetLoadFactor);
+}
+
+bool writeCSV(const string& filename) {
+    ofstream out(filename);
+    if (!out.is_open()) {
+        cerr << "Error opening file for writing: " << filename << endl;
+        return false;
+    }
+    out << "backend,hash,operation,vocabulary,key_lengths,target_load_factor,load_factor,"
+        << "ns_per_op,cache_misses_per_op\n";
+    for (const Result& r : results) {
+        out << r.backend << ',' << r.hash << ',' << r.operation << ',' << r.vocabulary << ',' << r.keyLengths << ','
+            << r.targetLoadFactor << ',' << r.loadFactor << ',' << r.measurement.nsPerOp << ','
+            << r.measurement.cacheMissesPerOp << '\n';
+    }
+    return (bool)out;
+}
+
+int main(int argc, char* argv[]) {
+    bool quick = false;
+    string csvFile;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--quick") {
+            quick = true;
+        }
+        else if (arg == "--csv" && i + 1 < argc) {
+            csvFile = argv[++i];
+        }
+        else {
+            cerr << "Usage: bench [--quick] [--csv results.csv]" << endl;
+            return 1;
+        }
+    }
+
+    // Key lengths follow the words in final.csv; the short and long variants
+    // shift that distribution below and past the small string limit
+    vector<WordFreq> modelWords;
+    if (!readWordFrequenciesFromTransposedCSV("final.csv", modelWords) || modelWords.empty()) {
+        return 1;
+    }
+    vector<int> finalLengths, shortLengths, longLengths;
+    for (const WordFreq& wf : modelWords) {
+        int length = (int)wf.word.size();
+        finalLengths.push_back(length);
+        shortLengths.push_back(max(1, length / 2));
+        longLengths.push_back(length + 16);
+    }
+
+    cout << "Cache miss counter: " << (cacheMisses.available() ? "perf_event_open" : "unavailable") << endl;
+
+    HashPolicy hashes[] = {{"wordHash64", wordHash64}, {"polynomialHash37", polynomialHash37}, {"fnv1a", fnv1aHash}};
+    vector<size_t> vocabularies = quick ? vector<size_t>{1000, 10000} : vector<size_t>{1000, 10000, 100000, 1000000};
+    vector<pair<string, vector<int>>> lengthSets = {{"final", finalLengths}, {"short", shortLengths}, {"long", longLengths}};
+    vector<string> generatedFiles;
+
+    // Every backend and hash over vocabulary sizes and key lengths, with the
+    // maps started small so they grow to their natural load factor
+    for (size_t vocabulary : vocabularies) {
+        for (const auto& lengths : lengthSets) {
+            if (quick && lengths.first != "final") {
+                continue;
+            }
+            Workload w = makeWorkload(vocabulary, lengths.first, lengths.second);
+            generatedFiles.push_back(w.csvFile);
+            generatedFiles.push_back(w.modelFile);
+            for (const HashPolicy& hash : hashes) {
+                benchAllBackends(hash, w, 997);
+            }
+            benchCompiledModel(w);
+            benchQuantized(w);
+            benchAutomaton(w);
+        }
+    }
+
+    // Load factor sweep: every map is created with the same power-of-two
+    // capacity and each target gets the vocabulary that fills it to that
+    // load, rounded down so no map is pushed over its growth limit. Sizing
+    // the map from the vocabulary instead would be rounded up to the next
+    // power of two and land most targets on the same size.
+    {
+        int capacity = quick ? 16384 : 131072;
+        for (double target : {0.25, 0.5, 0.7, 0.9}) {
+            Workload w = makeWorkload((size_t)(target * capacity), "final", finalLengths);
+            generatedFiles.push_back(w.csvFile);
+            generatedFiles.push_back(w.modelFile);
+            benchAllBackends(hashes[0], w, capacity, target);
+        }
+    }
+
+    for (const string& file : generatedFiles) {
+        remove(file.c_str());
+    }
+    if (!csvFile.empty()) {
+        if (!writeCSV(csvFile)) {
+            return 1;
+        }
+        cout << "Wrote " << results.size() << " results to " << csvFile << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,378 @@
+#ifndef CLASSIFIER_H
+#define CLASSIFIER_H
+
+#include "hashmap.h"
+#include "bloomfilter.h"
+#include "compiledmodel.h"
+#include "concurrentmap.h"
+#include "perfecthash.h"
+#include "quantizedmodel.h"
+#include "tokenizer.h"
+#include "wordautomaton.h"
+#include "corpus.h"
+#include "stats.h"
+#include <memory>
+
+// Calls onWord(entry) for every word of text[0, length), in order, with the
+// map's entry for it or nullptr. The text is tokenized, and so lowercased,
+// in place; WordAutomaton has its own version that reads the text once.
+template <class Map, class OnWord>
+void forEachModelWord(Map* map, char* text, size_t length, OnWord&& onWord) {
+    tokenizeInPlace(text, length, [&](string_view token) {
+        onWord(map->search(token));
+    });
+}
+
+// Scores emails against one map type. search is called on Map directly, so
+// for the concrete (final) map classes there is no virtual call per word and
+// the lookup can be inlined into the scoring loop. BasicEmailClassifier<HashMap>
+// gives the old behaviour of one virtual call per word.
+template <class Map>
+class BasicEmailClassifier {
+private:
+    enum {
+        PREFETCH_DISTANCE = 16,          //tokens hashed ahead of the one being scored
+        PREFETCH_MIN_WORDS = 65536,      //smaller models stay in cache and are not prefetched
+        SETTLED_CHECK_INTERVAL = 8       //tokens between checks for an early verdict
+    };
+
+    Map* wordMap;
+    double threshold;
+    ClassifierStats* stats;     //nullptr unless setStats was called
+
+    // A word used `times` times counts as that many separate words. The
+    // word's score was computed when its counts were loaded or changed.
+    template <class Entry>
+    static void addWord(const Entry* wf, double& spamScore, double& totalWords, double times = 1.0) {
+        if (wf) {
+            float wordScore = wf->getSpamScore();
+            if (wordScore >= 0) {
+                spamScore += times * wordScore;
+                totalWords += times;
+            }
+        }
+    }
+
+    // True once `remaining` more tokens cannot change the verdict. Each one
+    // either is unknown or adds a score between 0 and 1 over one more word,
+    // so the final average lies between spamScore / (totalWords + remaining)
+    // and (spamScore + remaining) / (totalWords + remaining). Both bounds are
+    // compared as averages, the same test every other verdict uses.
+    bool verdictSettled(double spamScore, double totalWords, size_t remaining) const {
+        double mostWords = totalWords + remaining;
+        return (totalWords > 0 && isSpam(spamScore, mostWords)) || (spamScore + remaining) / mostWords < threshold;
+    }
+
+    // The one spam test: the average score against the threshold. A score
+    // from score() or scoreText() is compared the same way.
+    bool isSpam(double spamScore, double totalWords) const {
+        return (totalWords > 0 && (spamScore / totalWords) >= threshold);
+    }
+
+    chrono::steady_clock::time_point startTiming() const {
+        return stats ? ClassifierStats::now() : chrono::steady_clock::time_point();
+    }
+
+    static double averageScore(double spamScore, double totalWords) {
+        return totalWords > 0 ? spamScore / totalWords : -1.0;
+    }
+
+    // Adds up one sparse email, each word weighted by its count
+    void scoreSparse(const vector<string>& vocabulary, const WordCount* begin, const WordCount* end,
+                     double& spamScore, double& totalWords) const {
+        auto start = startTiming();
+        uint64_t tokens = 0, hits = 0;
+
+        for (const WordCount* wc = begin; wc != end; ++wc) {
+            auto wf = wordMap->search(vocabulary[wc->wordId]);
+            hits += wf ? wc->count : 0;
+            tokens += wc->count;
+            addWord(wf, spamScore, totalWords, wc->count);
+        }
+
+        if (stats) {
+            stats->record(start, 1, tokens, hits, isSpam(spamScore, totalWords));
+        }
+    }
+
+    // The batch loop behind classifyBatch and scoreBatch. Calls
+    // onEmail(email, spamScore, totalWords) once per email, in order.
+    // A token's bucket is prefetched PREFETCH_DISTANCE tokens ahead and the
+    // entry it points to half as far ahead. For a model that fits in cache
+    // the prefetches only add work, so it is looked up token by token.
+    template <class OnEmail>
+    void scoreStream(const vector<string_view>& tokens, const vector<size_t>& emailEnds, OnEmail&& onEmail) const {
+        auto start = startTiming();
+        uint64_t hits = 0, spamCount = 0;
+
+        bool prefetching = wordMap->getCount() >= PREFETCH_MIN_WORDS;
+        uint64_t hashes[PREFETCH_DISTANCE];
+        size_t tokenCount = tokens.size();
+        for (size_t i = 0; prefetching && i < tokenCount && i < PREFETCH_DISTANCE; i++) {
+            hashes[i] = wordMap->hashCode(tokens[i]);
+            wordMap->prefetch(hashes[i]);
+        }
+
+        size_t i = 0;
+        for (size_t email = 0; email < emailEnds.size(); email++) {
+            double spamScore = 0.0;
+            double totalWords = 0.0;
+            size_t emailEnd = min(emailEnds[email], tokenCount);
+
+            if (!prefetching) {
+                for (; i < emailEnd; i++) {
+                    auto wf = wordMap->search(tokens[i]);
+                    hits += wf != nullptr;
+                    addWord(wf, spamScore, totalWords);
+                }
+            }
+            for (; i < emailEnd; i++) {
+                uint64_t hashVal = hashes[i % PREFETCH_DISTANCE];
+                if (i + PREFETCH_DISTANCE / 2 < tokenCount) {
+                    wordMap->prefetchEntry(hashes[(i + PREFETCH_DISTANCE / 2) % PREFETCH_DISTANCE]);
+                }
+                if (i + PREFETCH_DISTANCE < tokenCount) {
+                    uint64_t aheadHash = wordMap->hashCode(tokens[i + PREFETCH_DISTANCE]);
+                    hashes[i % PREFETCH_DISTANCE] = aheadHash;
+                    wordMap->prefetch(aheadHash);
+                }
+
+                auto wf = wordMap->searchHashed(tokens[i], hashVal);
+                hits += wf != nullptr;
+                addWord(wf, spamScore, totalWords);
+            }
+
+            spamCount += isSpam(spamScore, totalWords);
+            onEmail(email, spamScore, totalWords);
+        }
+
+        if (stats) {
+            stats->record(start, emailEnds.size(), tokenCount, hits, spamCount);
+        }
+    }
+
+public:
+    BasicEmailClassifier(Map* map, double thresh = 0.7)
+        : wordMap(map), threshold(thresh), stats(nullptr) {}
+
+    // Counts every later call in s, which must outlive the classifier
+    void setStats(ClassifierStats* s) { stats = s; }
+
+    // Average spam score of the email's words that the model knows, from 0 to
+    // 1, or -1 when it knows none of them. The email is spam when the score
+    // is at least the threshold.
+    template <class Words>
+    double score(const Words& emailWords) const {
+        auto start = startTiming();
+        double spamScore = 0.0;
+        double totalWords = 0.0;
+        uint64_t tokens = 0, hits = 0;
+
+        for (string_view word : emailWords) {
+            auto wf = wordMap->search(word);
+            hits += wf != nullptr;
+            tokens++;
+            addWord(wf, spamScore, totalWords);
+        }
+
+        if (stats) {
+            stats->record(start, 1, tokens, hits, isSpam(spamScore, totalWords));
+        }
+        return averageScore(spamScore, totalWords);
+    }
+
+    // score() for raw email text, without a token vector. The whole text is
+    // read; there is no early exit as in classify().
+    double scoreText(char* text, size_t length) const {
+        auto start = startTiming();
+        double spamScore = 0.0;
+        double totalWords = 0.0;
+        uint64_t tokens = 0, hits = 0;
+
+        forEachModelWord(wordMap, text, length, [&](const auto* wf) {
+            hits += wf != nullptr;
+            tokens++;
+            addWord(wf, spamScore, totalWords);
+        });
+
+        if (stats) {
+            stats->record(start, 1, tokens, hits, isSpam(spamScore, totalWords));
+        }
+        return averageScore(spamScore, totalWords);
+    }
+
+    bool classifyText(char* text, size_t length) const {
+        double textScore = scoreText(text, length);
+        return textScore >= 0 && textScore >= threshold;
+    }
+
+    // Words can be strings or string_views into the email text; nothing is
+    // copied. Stops reading the email as soon as the rest of it cannot change
+    // the verdict, so a clear-cut long email costs a fraction of a full scan.
+    template <class Words>
+    bool classify(const Words& emailWords) const {
+        auto start = startTiming();
+        double spamScore = 0.0;
+        double totalWords = 0.0;
+        uint64_t tokens = 0, hits = 0;
+
+        auto word = begin(emailWords);
+        auto last = end(emailWords);
+        size_t remaining = (size_t)distance(word, last);
+        for (; word != last; ++word, --remaining) {
+            if (tokens % SETTLED_CHECK_INTERVAL == SETTLED_CHECK_INTERVAL - 1 &&
+                verdictSettled(spamScore, totalWords, remaining)) {
+                break;
+            }
+            auto wf = wordMap->search(string_view(*word));
+            hits += wf != nullptr;
+            tokens++;
+            addWord(wf, spamScore, totalWords);
+        }
+
+        // With remaining 0 this is isSpam on the whole email. If the loop
+        // stopped early it repeats the test that settled the verdict: the
+        // lowest average the email could still reach.
+        bool spam = totalWords > 0 && isSpam(spamScore, totalWords + remaining);
+        if (stats) {
+            stats->record(start, 1, tokens, hits, spam);
+        }
+        return spam;
+    }
+
+    // Classifies one sparse email whose word ids index vocabulary. Scores the
+    // same as classify() on the email with every word repeated count times
+    // (up to rounding), with one lookup per distinct word.
+    bool classify(const vector<string>& vocabulary, const WordCount* begin, const WordCount* end) const {
+        double spamScore = 0.0;
+        double totalWords = 0.0;
+        scoreSparse(vocabulary, begin, end, spamScore, totalWords);
+        return isSpam(spamScore, totalWords);
+    }
+
+    bool classify(const SparseCorpus& corpus, size_t email) const {
+        return classify(corpus.vocabulary, corpus.begin(email), corpus.end(email));
+    }
+
+    // The score of one sparse email, as score() would give it for the
+    // repeated words
+    double score(const SparseCorpus& corpus, size_t email) const {
+        double spamScore = 0.0;
+        double totalWords = 0.0;
+        scoreSparse(corpus.vocabulary, corpus.begin(email), corpus.end(email), spamScore, totalWords);
+        return averageScore(spamScore, totalWords);
+    }
+
+    // Classifies many emails stored back to back in one token stream; email i
+    // ends just before tokens[emailEnds[i]]. On a model too big for the cache,
+    // each token is hashed and its bucket prefetched PREFETCH_DISTANCE tokens
+    // before it is looked up, so the cache misses of several lookups overlap
+    // instead of stalling one by one.
+    void classifyBatch(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<bool>& verdicts) const {
+        verdicts.assign(emailEnds.size(), false);
+        scoreStream(tokens, emailEnds, [&](size_t email, double spamScore, double totalWords) {
+            verdicts[email] = isSpam(spamScore, totalWords);
+        });
+    }
+
+    // Like classifyBatch, but gives each email's score as score() would
+    void scoreBatch(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<double>& scores) const {
+        scores.assign(emailEnds.size(), -1.0);
+        scoreStream(tokens, emailEnds, [&](size_t email, double spamScore, double totalWords) {
+            scores[email] = averageScore(spamScore, totalWords);
+        });
+    }
+
+    double getThreshold() const { return threshold; }
+
+    void classifyBatch(const vector<vector<string_view>>& emails, vector<bool>& verdicts) const {
+        vector<string_view> tokens;
+        vector<size_t> emailEnds;
+        emailEnds.reserve(emails.size());
+        for (const vector<string_view>& email : emails) {
+            tokens.insert(tokens.end(), email.begin(), email.end());
+            emailEnds.push_back(tokens.size());
+        }
+        classifyBatch(tokens, emailEnds, verdicts);
+    }
+};
+
+// Classifier for code that picks the map at run time, like the GUI. It
+// remembers the map's real type, so the only virtual call is one per email.
+class EmailClassifier {
+private:
+    struct Scorer {
+        virtual ~Scorer() {}
+        virtual bool classify(const vector<string>& emailWords) = 0;
+        virtual bool classify(const vector<string_view>& emailWords) = 0;
+        virtual void classifyBatch(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<bool>& verdicts) = 0;
+        virtual double score(const vector<string_view>& emailWords) = 0;
+        virtual void scoreBatch(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<double>& scores) = 0;
+        virtual double scoreText(char* text, size_t length) = 0;
+        virtual void setStats(ClassifierStats* stats) = 0;
+    };
+
+    template <class Map>
+    struct TypedScorer : Scorer {
+        BasicEmailClassifier<Map> classifier;
+
+        TypedScorer(Map* map, double thresh) : classifier(map, thresh) {}
+
+        bool classify(const vector<string>& emailWords) override { return classifier.classify(emailWords); }
+        bool classify(const vector<string_view>& emailWords) override { return classifier.classify(emailWords); }
+        void classifyBatch(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<bool>& verdicts) override {
+            classifier.classifyBatch(tokens, emailEnds, verdicts);
+        }
+        double score(const vector<string_view>& emailWords) override { return classifier.score(emailWords); }
+        void scoreBatch(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<double>& scores) override {
+            classifier.scoreBatch(tokens, emailEnds, scores);
+        }
+        double scoreText(char* text, size_t length) override { return classifier.scoreText(text, length); }
+        void setStats(ClassifierStats* stats) override { classifier.setStats(stats); }
+    };
+
+    unique_ptr<Scorer> scorer;
+
+public:
+    // Map is any of the HashMap classes, HashMap itself, a ConcurrentHashMap, a
+    // CompiledModel, a QuantizedModel or a WordAutomaton
+    template <class Map>
+    EmailClassifier(Map* map, double thresh = 0.7)
+        : scorer(new TypedScorer<Map>(map, thresh)) {}
+
+    bool classify(const vector<string>& emailWords) {
+        return scorer->classify(emailWords);
+    }
+
+    // Tokens may point straight into the email text; classifying never allocates
+    bool classify(const vector<string_view>& emailWords) {
+        return scorer->classify(emailWords);
+    }
+
+    // See BasicEmailClassifier::classifyBatch
+    void classifyBatch(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<bool>& verdicts) {
+        scorer->classifyBatch(tokens, emailEnds, verdicts);
+    }
+
+    // See BasicEmailClassifier::score
+    double score(const vector<string_view>& emailWords) {
+        return scorer->score(emailWords);
+    }
+
+    // See BasicEmailClassifier::scoreBatch
+    void scoreBatch(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<double>& scores) {
+        scorer->scoreBatch(tokens, emailEnds, scores);
+    }
+
+    // See BasicEmailClassifier::scoreText
+    double scoreText(char* text, size_t length) {
+        return scorer->scoreText(text, length);
+    }
+
+    // See BasicEmailClassifier::setStats
+    void setStats(ClassifierStats* stats) {
+        scorer->setStats(stats);
+    }
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "engine.h"
+#include "emailstream.h"
+#include <charconv>
+#include <cstdlib>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Command line classifier for mail pipelines: reads emails from stdin or the
+// given files and writes one line per email, in input order:
+//   <email number> TAB spam|ham TAB <score>
+// The score is the average spam score of the words the model knows, or -1
+// when it knows none of them. Input is read in 1 MB blocks and each block is
+// scored with one scoreBatch call; output is buffered and written in blocks.
+// With --map automaton, lines and NDJSON texts are instead scored one by one
+// in a single pass over the text, without tokenizing them.
+//   classify [--model final.csv|final.model]
+//            [--map flat|chaining|open|arena|perfect|automaton|quantized|quantized8] [--bloom]
+//            [--format lines|ndjson|mbox] [--field text] [--threshold 0.7] [--stats] [file ...]
+
+enum { OUTPUT_FLUSH_SIZE = 1 << 20 };
+
+struct Options {
+    string modelFile;
+    string backend;
+    EmailFormat format;
+    string field;           //NDJSON field holding the email text
+    double threshold;
+    bool prefilter;         //Bloom filter in front of the map
+    bool printStats;
+    vector<string> inputs;
+
+    Options() : modelFile("final.csv"), backend("flat"), format(FORMAT_LINES), field("text"),
+                threshold(0.7), prefilter(false), printStats(false) {}
+};
+
+bool parseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--model" && hasValue) {
+            options.modelFile = argv[++i];
+        }
+        else if (arg == "--map" && hasValue) {
+            options.backend = argv[++i];
+        }
+        else if (arg == "--format" && hasValue) {
+            if (!parseEmailFormat(argv[++i], options.format)) {
+                cerr << "Error: unknown format " << argv[i] << endl;
+                return false;
+            }
+        }
+        else if (arg == "--field" && hasValue) {
+            options.field = argv[++i];
+        }
+        else if (arg == "--threshold" && hasValue) {
+            options.threshold = atof(argv[++i]);
+        }
+        else if (arg == "--bloom") {
+            options.prefilter = true;
+        }
+        else if (arg == "--stats") {
+            options.printStats = true;
+        }
+        else if (arg.size() > 1 && arg[0] == '-' && arg != "-") {
+            cerr << "Error: unknown option " << arg << endl;
+            return false;
+        }
+        else {
+            options.inputs.push_back(arg);
+        }
+    }
+    if (options.inputs.empty()) {
+        options.inputs.push_back("-");
+    }
+    return true;
+}
+
+class OutputBuffer {
+private:
+    string buffer;
+    bool failed;
+
+public:
+    OutputBuffer() : failed(false) {
+        buffer.reserve(OUTPUT_FLUSH_SIZE + 256);
+    }
+
+    void writeVerdict(uint64_t email, bool spam, double score) {
+        char line[64];
+        char* p = to_chars(line, line + 24, email).ptr;
+        memcpy(p, spam ? "\tspam\t" : "\tham\t", spam ? 6 : 5);
+        p += spam ? 6 : 5;
+        p = to_chars(p, line + sizeof(line) - 1, score, chars_format::fixed, 4).ptr;
+        *p++ = '\n';
+        buffer.append(line, p - line);
+        if (buffer.size() >= OUTPUT_FLUSH_SIZE) {
+            flush();
+        }
+    }
+
+    bool flush() {
+        if (!buffer.empty() && fwrite(buffer.data(), 1, buffer.size(), stdout) != buffer.size()) {
+            failed = true;
+        }
+        buffer.clear();
+        return !failed && fflush(stdout) == 0;
+    }
+};
+
+// Adds the words of one record to the token stream
+void tokenizeRecord(const Options& options, char* record, size_t length, vector<string_view>& tokens) {
+    auto addToken = [&](string_view token) {
+        tokens.push_back(token);
+    };
+    if (options.format == FORMAT_LINES) {
+        tokenizeInPlace(record, length, addToken);
+    }
+    else if (options.format == FORMAT_NDJSON) {
+        char* text;
+        size_t textLength;
+        if (findJsonStringField(record, record + length, options.field, text, textLength)) {
+            tokenizeInPlace(text, textLength, addToken);
+        }
+    }
+    else {
+        char *subject, *body;
+        size_t subjectLength, bodyLength;
+        splitMboxMessage(record, length, subject, subjectLength, body, bodyLength);
+        if (subject) {
+            tokenizeInPlace(subject, subjectLength, addToken);
+        }
+        tokenizeInPlace(body, bodyLength, addToken);
+    }
+}
+
+// Scores one line or NDJSON record straight from its text
+double scoreRecordText(const Options& options, SpamEngine& engine, char* record, size_t length) {
+    if (options.format == FORMAT_LINES) {
+        return engine.scoreText(record, length);
+    }
+    char* text;
+    size_t textLength;
+    if (findJsonStringField(record, record + length, options.field, text, textLength)) {
+        return engine.scoreText(text, textLength);
+    }
+    return engine.scoreText(record, 0);
+}
+
+bool classifyStream(FILE* input, const Options& options, SpamEngine& engine, OutputBuffer& output, uint64_t& emailNumber) {
+    EmailStreamReader reader(input, options.format);
+    bool scanText = engine.scansText() && options.format != FORMAT_MBOX;
+    vector<string_view> tokens;
+    vector<size_t> emailEnds;
+    vector<double> scores;
+
+    while (reader.fill()) {
+        tokens.clear();
+        emailEnds.clear();
+        char* record;
+        size_t length;
+        while (reader.next(record, length)) {
+            if (scanText) {
+                double score = scoreRecordText(options, engine, record, length);
+                output.writeVerdict(++emailNumber, engine.isSpamScore(score), score);
+                continue;
+            }
+            tokenizeRecord(options, record, length, tokens);
+            emailEnds.push_back(tokens.size());
+        }
+        if (emailEnds.empty()) {
+            continue;
+        }
+
+        engine.scoreBatch(tokens, emailEnds, scores);
+        for (double score : scores) {
+            output.writeVerdict(++emailNumber, engine.isSpamScore(score), score);
+        }
+    }
+    return !reader.failed();
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        return 2;
+    }
+
+    SpamEngine engine;
+    if (!engine.open(options.modelFile, options.backend, options.threshold, options.prefilter)) {
+        cerr << "Failed to load the model from " << options.modelFile << endl;
+        return 1;
+    }
+    ClassifierStats stats;
+    if (options.printStats) {
+        engine.setStats(&stats);
+    }
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    OutputBuffer output;
+    uint64_t emailNumber = 0;
+    bool ok = true;
+    for (const string& input : options.inputs) {
+        FILE* file = input == "-" ? stdin : fopen(input.c_str(), "rb");
+        if (!file) {
+            cerr << "Error opening file: " << input << endl;
+            ok = false;
+            continue;
+        }
+        if (!classifyStream(file, options, engine, output, emailNumber)) {
+            cerr << "Error reading " << input << endl;
+            ok = false;
+        }
+        if (file != stdin) {
+            fclose(file);
+        }
+    }
+
+    if (!output.flush()) {
+        cerr << "Error writing the results" << endl;
+        ok = false;
+    }
+    if (options.printStats) {
+        stats.print(cerr, "classify");
+        printTableStats(cerr, options.modelFile, engine.getTableStats());
+    }
+    return ok ? 0 : 1;
+}
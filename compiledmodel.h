@@ -0,0 +1,293 @@
+#ifndef COMPILEDMODEL_H
+#define COMPILEDMODEL_H
+
+#include "hashmap.h"
+#include "mappedfile.h"
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <unordered_map>
+
+// Binary model image written by modelc and memory-mapped by CompiledModel.
+//
+// Layout (all offsets from the start of the file, sections 8-byte aligned):
+//   CompiledModelHeader
+//   CompiledModelEntry[wordCount]   frequencies, the precomputed spam score and
+//                                   the key's place in the pool
+//   uint32_t[indexSize]             open addressing index, 0 = empty, else entry + 1
+//   char[poolSize]                  all words back to back, not NUL terminated
+//
+// The image is stored in the byte order of the machine that compiled it.
+
+const char COMPILED_MODEL_MAGIC[8] = {'S', 'P', 'A', 'M', 'M', 'D', 'L', '\0'};
+const uint32_t COMPILED_MODEL_VERSION = 2;      //2: entries carry spamScore
+
+struct CompiledModelHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t wordCount;
+    uint32_t indexSize;         //always a power of two
+    uint32_t poolSize;
+    uint64_t entriesOffset;
+    uint64_t indexOffset;
+    uint64_t poolOffset;
+    uint64_t fileSize;
+};
+
+struct CompiledModelEntry {
+    uint32_t keyOffset;
+    uint32_t keyLength;
+    double spamFreq;
+    double hamFreq;
+    float spamScore;            //wordSpamScore(spamFreq, hamFreq)
+    uint32_t reserved;
+
+    float getSpamScore() const { return spamScore; }
+};
+
+// FNV-1a. It is part of the file format, so changing it means bumping the version.
+inline uint64_t compiledModelHash(const char* key, size_t length) {
+    uint64_t hashVal = 14695981039346656037ULL;
+    for (size_t i = 0; i < length; i++) {
+        hashVal ^= (unsigned char)key[i];
+        hashVal *= 1099511628211ULL;
+    }
+    return hashVal;
+}
+
+inline uint64_t alignTo8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+// Compiles word frequencies into a binary image. The image is written next
+// to the target and renamed into place, so readers never see half a file.
+inline bool compileModel(const vector<WordFreq>& wordFreqs, const string& modelFile) {
+    // Later columns overwrite earlier ones, the same as HashMap::insert
+    vector<WordFreq> words;
+    unordered_map<string, size_t> positions;
+    for (const WordFreq& wordFreq : wordFreqs) {
+        auto found = positions.find(wordFreq.word);
+        if (found != positions.end()) {
+            words[found->second] = wordFreq;
+        }
+        else {
+            positions[wordFreq.word] = words.size();
+            words.push_back(wordFreq);
+        }
+    }
+
+    uint32_t indexSize = 16;
+    while (indexSize < words.size() * 2) {
+        indexSize *= 2;
+    }
+
+    vector<CompiledModelEntry> entries(words.size());
+    vector<uint32_t> index(indexSize, 0);
+    string pool;
+
+    for (size_t i = 0; i < words.size(); i++) {
+        entries[i].keyOffset = (uint32_t)pool.size();
+        entries[i].keyLength = (uint32_t)words[i].word.size();
+        entries[i].spamFreq = words[i].spamFreq;
+        entries[i].hamFreq = words[i].hamFreq;
+        entries[i].spamScore = wordSpamScore(words[i].spamFreq, words[i].hamFreq);
+        entries[i].reserved = 0;
+        pool += words[i].word;
+
+        uint32_t slot = (uint32_t)compiledModelHash(words[i].word.data(), words[i].word.size()) & (indexSize - 1);
+        while (index[slot] != 0) {
+            slot = (slot + 1) & (indexSize - 1);
+        }
+        index[slot] = (uint32_t)i + 1;
+    }
+
+    CompiledModelHeader header;
+    memcpy(header.magic, COMPILED_MODEL_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_MODEL_VERSION;
+    header.wordCount = (uint32_t)entries.size();
+    header.indexSize = indexSize;
+    header.poolSize = (uint32_t)pool.size();
+    header.entriesOffset = alignTo8(sizeof(CompiledModelHeader));
+    header.indexOffset = alignTo8(header.entriesOffset + entries.size() * sizeof(CompiledModelEntry));
+    header.poolOffset = alignTo8(header.indexOffset + index.size() * sizeof(uint32_t));
+    header.fileSize = header.poolOffset + pool.size();
+
+    string image(header.fileSize, '\0');
+    memcpy(&image[0], &header, sizeof(header));
+    if (!entries.empty()) {
+        memcpy(&image[header.entriesOffset], entries.data(), entries.size() * sizeof(CompiledModelEntry));
+    }
+    memcpy(&image[header.indexOffset], index.data(), index.size() * sizeof(uint32_t));
+    if (!pool.empty()) {
+        memcpy(&image[header.poolOffset], pool.data(), pool.size());
+    }
+
+    return replaceFileContents(modelFile, image);
+}
+
+// Compiles the transposed CSV model into a binary image
+inline bool compileModel(const string& csvFile, const string& modelFile) {
+    vector<WordFreq> wordFreqs;
+    if (!readWordFrequenciesFromTransposedCSV(csvFile, wordFreqs)) {
+        return false;
+    }
+    return compileModel(wordFreqs, modelFile);
+}
+
+// Read-only view of a compiled model image. The file is mapped, not read, so
+// opening costs one syscall plus a header check and every process using the
+// same image shares its pages. Lookups never allocate, and a damaged entry
+// or index slot reads as a missing word.
+class CompiledModel {
+private:
+    MappedFile file;
+    const char* base;
+    size_t mappedSize;
+    const CompiledModelHeader* header;
+    const CompiledModelEntry* entries;
+    const uint32_t* index;
+    const char* pool;
+
+    // Checks the header and section bounds only, so open() stays O(1) and
+    // touches one page. Entries and index slots are checked as lookups reach them.
+    bool validate() {
+        if (mappedSize < sizeof(CompiledModelHeader)) {
+            return false;
+        }
+        header = (const CompiledModelHeader*)base;
+        if (memcmp(header->magic, COMPILED_MODEL_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != COMPILED_MODEL_VERSION || header->fileSize != mappedSize) {
+            return false;
+        }
+        if (header->indexSize == 0 || (header->indexSize & (header->indexSize - 1)) != 0 ||
+            header->wordCount >= header->indexSize) {
+            return false;
+        }
+        if (header->entriesOffset < sizeof(CompiledModelHeader) || header->entriesOffset % 8 != 0 ||
+            header->indexOffset % 4 != 0 || header->entriesOffset > header->indexOffset ||
+            header->indexOffset > header->poolOffset || header->poolOffset > mappedSize ||
+            (uint64_t)header->wordCount * sizeof(CompiledModelEntry) > header->indexOffset - header->entriesOffset ||
+            (uint64_t)header->indexSize * sizeof(uint32_t) > header->poolOffset - header->indexOffset ||
+            header->poolSize > mappedSize - header->poolOffset) {
+            return false;
+        }
+
+        entries = (const CompiledModelEntry*)(base + header->entriesOffset);
+        index = (const uint32_t*)(base + header->indexOffset);
+        pool = base + header->poolOffset;
+        return true;
+    }
+
+    // The entry an index slot refers to, or nullptr if the slot is out of range
+    // or the entry's key lies outside the pool
+    const CompiledModelEntry* entryAt(uint32_t slotValue) const {
+        if (slotValue > header->wordCount) {
+            return nullptr;
+        }
+        const CompiledModelEntry* entry = &entries[slotValue - 1];
+        if ((uint64_t)entry->keyOffset + entry->keyLength > header->poolSize) {
+            return nullptr;
+        }
+        return entry;
+    }
+
+public:
+    CompiledModel() : base(nullptr), mappedSize(0), header(nullptr), entries(nullptr), index(nullptr), pool(nullptr) {}
+
+    CompiledModel(const CompiledModel&) = delete;
+    CompiledModel& operator=(const CompiledModel&) = delete;
+
+    bool open(const string& filename) {
+        close();
+        if (!file.open(filename)) {
+            return false;
+        }
+        base = file.data();
+        mappedSize = file.size();
+
+        if (!validate()) {
+            cerr << "Error: " << filename << " is not a compatible compiled model" << endl;
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        file.close();
+        base = nullptr;
+        mappedSize = 0;
+        header = nullptr;
+        entries = nullptr;
+        index = nullptr;
+        pool = nullptr;
+    }
+
+    bool isOpen() const { return base != nullptr; }
+
+    const CompiledModelEntry* search(string_view key) const {
+        return searchHashed(key, hashCode(key));
+    }
+
+    uint64_t hashCode(string_view key) const {
+        return compiledModelHash(key.data(), key.size());
+    }
+
+    void prefetch(uint64_t hashVal) const {
+        if (base) {
+            prefetchAddress(&index[hashVal & (header->indexSize - 1)]);
+        }
+    }
+
+    void prefetchEntry(uint64_t hashVal) const {
+        uint32_t slotValue = base ? index[hashVal & (header->indexSize - 1)] : 0;
+        const CompiledModelEntry* entry = slotValue != 0 ? entryAt(slotValue) : nullptr;
+        if (entry) {
+            prefetchAddress(entry);
+            prefetchAddress(pool + entry->keyOffset);
+        }
+    }
+
+    const CompiledModelEntry* searchHashed(string_view key, uint64_t hashVal) const {
+        if (!base) {
+            return nullptr;
+        }
+
+        uint32_t mask = header->indexSize - 1;
+        uint32_t slot = (uint32_t)hashVal & mask;
+
+        // A sound image always has an empty slot; the bound stops a damaged one
+        for (uint32_t probes = 0; index[slot] != 0 && probes < header->indexSize; probes++) {
+            const CompiledModelEntry* entry = entryAt(index[slot]);
+            if (entry && entry->keyLength == key.size() && memcmp(pool + entry->keyOffset, key.data(), key.size()) == 0) {
+                return entry;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return nullptr;
+    }
+
+    int getCount() const { return header ? (int)header->wordCount : 0; }
+
+    TableStats getStats() const {
+        TableStats stats;
+        if (!base) {
+            return stats;
+        }
+        uint32_t mask = header->indexSize - 1;
+        stats.buckets = header->indexSize;
+        for (uint32_t slot = 0; slot < header->indexSize; slot++) {
+            const CompiledModelEntry* entry = index[slot] != 0 ? entryAt(index[slot]) : nullptr;
+            if (!entry) {
+                continue;
+            }
+            uint32_t home = (uint32_t)compiledModelHash(pool + entry->keyOffset, entry->keyLength) & mask;
+            addToHistogram(stats.probeLengths, ((slot - home) & mask) + 1);
+            stats.words++;
+            stats.usedBuckets++;
+        }
+        return stats;
+    }
+};
+
+#endif
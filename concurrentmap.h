@@ -0,0 +1,480 @@
+#ifndef CONCURRENTMAP_H
+#define CONCURRENTMAP_H
+
+#include "hashmap.h"
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Frees memory that lock-free readers might still be looking at. Each thread
+// that reads gets a record of its own the first time, and keeps it until it
+// exits. A reader announces the global epoch in its record when it enters
+// and clears it when it leaves. A writer that unlinks something retires it
+// under the current epoch and advances the epoch; the object is freed once
+// no reader is still in that epoch or an earlier one.
+class EpochReclaimer {
+private:
+    struct alignas(64) ReaderRecord {
+        atomic<uint64_t> epoch;     //0 outside a read
+        atomic<bool> claimed;       //owned by a running thread
+        int depth;                  //nested reads; only the owning thread touches it
+        ReaderRecord* next;         //fixed once the record is in the list
+
+        ReaderRecord() : epoch(0), claimed(true), depth(0), next(nullptr) {}
+    };
+
+    // The list of records. Threads share ownership of it with the reclaimer,
+    // so a thread that exits after the map is gone can still release its record.
+    struct Registry {
+        atomic<ReaderRecord*> head;
+
+        Registry() : head(nullptr) {}
+
+        ~Registry() {
+            ReaderRecord* record = head.load();
+            while (record) {
+                ReaderRecord* next = record->next;
+                delete record;
+                record = next;
+            }
+        }
+
+        // Reuses the record of a thread that has exited, or adds one
+        ReaderRecord* claim() {
+            for (ReaderRecord* record = head.load(memory_order_acquire); record; record = record->next) {
+                bool expected = false;
+                if (!record->claimed.load(memory_order_relaxed) &&
+                    record->claimed.compare_exchange_strong(expected, true, memory_order_acquire)) {
+                    return record;
+                }
+            }
+            ReaderRecord* record = new ReaderRecord();
+            record->next = head.load(memory_order_relaxed);
+            while (!head.compare_exchange_weak(record->next, record, memory_order_release, memory_order_relaxed)) {
+            }
+            return record;
+        }
+    };
+
+    // The records one thread holds, released when the thread exits
+    struct ThreadRecords {
+        vector<pair<shared_ptr<Registry>, ReaderRecord*>> held;
+
+        ~ThreadRecords() {
+            for (auto& entry : held) {
+                entry.second->epoch.store(0, memory_order_release);
+                entry.second->claimed.store(false, memory_order_release);
+            }
+        }
+    };
+
+    struct Retired {
+        uint64_t epoch;
+        function<void()> free;
+    };
+
+    shared_ptr<Registry> registry;
+    atomic<uint64_t> globalEpoch;
+    mutex retiredLock;
+    vector<Retired> retired;
+
+    // The last registry this thread read from and its record there
+    static Registry*& cachedRegistry() {
+        static thread_local Registry* registry = nullptr;
+        return registry;
+    }
+
+    static ReaderRecord*& cachedRecord() {
+        static thread_local ReaderRecord* record = nullptr;
+        return record;
+    }
+
+    ReaderRecord* recordForThread() {
+        if (cachedRegistry() == registry.get()) {
+            return cachedRecord();
+        }
+        return claimRecordForThread();
+    }
+
+    // A thread that reads from several maps holds a record in each. Entries
+    // whose map is gone are dropped; the cache is reset below, so it never
+    // points at a freed registry.
+#if defined(__GNUC__) || defined(__clang__)
+    __attribute__((noinline))
+#endif
+    ReaderRecord* claimRecordForThread() {
+        static thread_local ThreadRecords mine;
+        ReaderRecord* record = nullptr;
+        size_t kept = 0;
+        for (size_t i = 0; i < mine.held.size(); i++) {
+            if (mine.held[i].first == registry) {
+                record = mine.held[i].second;
+            }
+            else if (mine.held[i].first.use_count() == 1) {
+                continue;
+            }
+            if (kept++ != i) {
+                mine.held[kept - 1] = std::move(mine.held[i]);
+            }
+        }
+        mine.held.resize(kept);
+        if (!record) {
+            record = registry->claim();
+            mine.held.push_back(make_pair(registry, record));
+        }
+        cachedRegistry() = registry.get();
+        cachedRecord() = record;
+        return record;
+    }
+
+public:
+    EpochReclaimer() : registry(make_shared<Registry>()), globalEpoch(1) {}
+
+    ~EpochReclaimer() {
+        for (Retired& r : retired) {
+            r.free();
+        }
+    }
+
+    EpochReclaimer(const EpochReclaimer&) = delete;
+    EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+    // One store to this thread's record; never waits for other threads. The
+    // fence orders the announcement before every load the reader makes
+    // afterwards. A seq_cst store would do the same, but as an xchg on the
+    // record it made a lookup about three times slower.
+    void enter() {
+        ReaderRecord* record = recordForThread();
+        if (record->depth++ == 0) {
+            record->epoch.store(globalEpoch.load(memory_order_relaxed), memory_order_relaxed);
+            atomic_thread_fence(memory_order_seq_cst);
+        }
+    }
+
+    void leave() {
+        ReaderRecord* record = recordForThread();
+        if (--record->depth == 0) {
+            record->epoch.store(0, memory_order_release);
+        }
+    }
+
+    // Frees whatever no reader can still see. Retired objects wait for the
+    // readers that were already inside when they were unlinked.
+    void retire(function<void()> free) {
+        lock_guard<mutex> guard(retiredLock);
+        Retired r = {globalEpoch.fetch_add(1), std::move(free)};
+        retired.push_back(std::move(r));
+
+        // Pairs with the fence in enter(): a reader either sees the unlink or
+        // has its epoch seen here
+        atomic_thread_fence(memory_order_seq_cst);
+        uint64_t oldestReader = UINT64_MAX;
+        for (ReaderRecord* record = registry->head.load(); record; record = record->next) {
+            uint64_t epoch = record->epoch.load();
+            if (epoch != 0 && epoch < oldestReader) {
+                oldestReader = epoch;
+            }
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++) {
+            if (retired[i].epoch < oldestReader) {
+                retired[i].free();
+            }
+            else if (kept++ != i) {
+                retired[kept - 1] = std::move(retired[i]);
+            }
+        }
+        retired.resize(kept);
+    }
+
+    size_t pendingCount() {
+        lock_guard<mutex> guard(retiredLock);
+        return retired.size();
+    }
+};
+
+// Word counts that can be updated while other threads read them
+struct ConcurrentWordFreq {
+    const string word;
+    atomic<double> spamFreq;
+    atomic<double> hamFreq;
+    atomic<float> spamScore;
+
+    ConcurrentWordFreq(const string& w, double spam, double ham)
+        : word(w), spamFreq(spam), hamFreq(ham), spamScore(wordSpamScore(spam, ham)) {}
+
+    // Recomputes the score after the counts changed. If another update lands
+    // meanwhile, the loop runs again, so the score written last always
+    // reflects counts at least as new as every finished update.
+    void updateScore() {
+        double spam, ham;
+        do {
+            spam = spamFreq.load();
+            ham = hamFreq.load();
+            spamScore.store(wordSpamScore(spam, ham));
+        } while (spamFreq.load() != spam || hamFreq.load() != ham);
+    }
+
+    float getSpamScore() const { return spamScore.load(memory_order_relaxed); }
+};
+
+// Chaining map for a model that keeps learning while it is being read.
+//  - Lookups take no locks and never wait for another thread: a reader
+//    announces the epoch with one store to its own record, walks one chain
+//    and clears the record.
+//  - Counts of existing words are updated in place with atomic adds.
+//  - New words are inserted under one of STRIPES locks picked by the low bits
+//    of the hash, so inserts into different buckets do not wait on each other.
+//  - Growing takes every stripe lock, links the same entries into a table
+//    twice the size and publishes it; the old table and its links are freed
+//    through the EpochReclaimer once no reader can still be walking them.
+// Entries never move, so a pointer from search stays valid until clear() or
+// the destructor, which must not run while other threads use the map.
+// Used through BasicEmailClassifier<ConcurrentHashMap> like CompiledModel.
+class ConcurrentHashMap {
+private:
+    enum { STRIPES = 64 };
+
+    struct Link {
+        ConcurrentWordFreq* entry;
+        uint64_t hashVal;
+        atomic<Link*> next;
+    };
+
+    struct Table {
+        size_t mask;
+        atomic<Link*>* buckets;
+
+        Table(size_t size) : mask(size - 1), buckets(new atomic<Link*>[size]) {
+            for (size_t i = 0; i < size; i++) {
+                buckets[i].store(nullptr, memory_order_relaxed);
+            }
+        }
+
+        // Frees the links; entries belong to whichever table is current
+        ~Table() {
+            for (size_t i = 0; i <= mask; i++) {
+                Link* link = buckets[i].load(memory_order_relaxed);
+                while (link) {
+                    Link* next = link->next.load(memory_order_relaxed);
+                    delete link;
+                    link = next;
+                }
+            }
+            delete[] buckets;
+        }
+    };
+
+    // Keeps this thread's epoch announced for the length of one read
+    class ReadGuard {
+    private:
+        EpochReclaimer& epochs;
+
+    public:
+        ReadGuard(EpochReclaimer& e) : epochs(e) { epochs.enter(); }
+        ~ReadGuard() { epochs.leave(); }
+    };
+
+    HashFunction hashFunction;
+    atomic<Table*> table;
+    atomic<int> count;
+    mutex stripes[STRIPES];
+    EpochReclaimer epochs;
+
+    static size_t roundUpToPowerOfTwo(int n) {
+        size_t size = STRIPES;
+        while (size < (size_t)n) {
+            size *= 2;
+        }
+        return size;
+    }
+
+    static void atomicAdd(atomic<double>& target, double amount) {
+        double current = target.load(memory_order_relaxed);
+        while (!target.compare_exchange_weak(current, current + amount, memory_order_relaxed)) {
+        }
+    }
+
+    static ConcurrentWordFreq* find(Table* t, string_view key, uint64_t hashVal) {
+        Link* link = t->buckets[hashVal & t->mask].load(memory_order_acquire);
+        while (link) {
+            if (link->hashVal == hashVal && link->entry->word == key) {
+                return link->entry;
+            }
+            link = link->next.load(memory_order_acquire);
+        }
+        return nullptr;
+    }
+
+    static void pushFront(Table* t, ConcurrentWordFreq* entry, uint64_t hashVal) {
+        atomic<Link*>& bucket = t->buckets[hashVal & t->mask];
+        Link* link = new Link();
+        link->entry = entry;
+        link->hashVal = hashVal;
+        link->next.store(bucket.load(memory_order_relaxed), memory_order_relaxed);
+        bucket.store(link, memory_order_release);
+    }
+
+    // Adds key with the given counts, or to its counts if another thread got
+    // there first. overwrite replaces the counts instead, as HashMap::insert does.
+    void insertOrAdd(string_view key, double spamFreq, double hamFreq, bool overwrite) {
+        uint64_t hashVal = hashCode(key);
+        bool grow = false;
+        {
+            lock_guard<mutex> guard(stripes[hashVal & (STRIPES - 1)]);
+            // Resizes hold every stripe, so the table cannot change under us
+            Table* t = table.load(memory_order_acquire);
+            ConcurrentWordFreq* existing = find(t, key, hashVal);
+            if (existing) {
+                if (overwrite) {
+                    existing->spamFreq.store(spamFreq);
+                    existing->hamFreq.store(hamFreq);
+                }
+                else {
+                    atomicAdd(existing->spamFreq, spamFreq);
+                    atomicAdd(existing->hamFreq, hamFreq);
+                }
+                existing->updateScore();
+                return;
+            }
+            pushFront(t, new ConcurrentWordFreq(string(key), spamFreq, hamFreq), hashVal);
+            grow = count.fetch_add(1) + 1 > (int)(t->mask + 1);
+        }
+        if (grow) {
+            resize();
+        }
+    }
+
+    void resize() {
+        for (mutex& stripe : stripes) {
+            stripe.lock();
+        }
+        Table* old = table.load(memory_order_relaxed);
+        bool grew = count.load() > (int)(old->mask + 1);
+        if (grew) {
+            Table* grown = new Table((old->mask + 1) * 2);
+            for (size_t i = 0; i <= old->mask; i++) {
+                for (Link* link = old->buckets[i].load(memory_order_relaxed); link; link = link->next.load(memory_order_relaxed)) {
+                    pushFront(grown, link->entry, link->hashVal);
+                }
+            }
+            table.store(grown);
+        }
+        for (mutex& stripe : stripes) {
+            stripe.unlock();
+        }
+        if (grew) {
+            epochs.retire([old]() { delete old; });
+        }
+    }
+
+public:
+    ConcurrentHashMap(int s = 997, HashFunction h = wordHash64)
+        : hashFunction(h), table(new Table(roundUpToPowerOfTwo(s))), count(0) {}
+
+    ~ConcurrentHashMap() {
+        clear();
+        delete table.load();
+    }
+
+    ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+    ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+    uint64_t hashCode(string_view key) const {
+        return hashFunction(key);
+    }
+
+    // Sets the word's counts, like HashMap::insert
+    void insert(const WordFreq& data) {
+        insertOrAdd(data.word, data.spamFreq, data.hamFreq, true);
+    }
+
+    // Adds to the word's counts, inserting it if it is new. Safe to call from
+    // any number of threads alongside lookups.
+    void addCounts(string_view word, double spamFreq, double hamFreq) {
+        ConcurrentWordFreq* entry = search(word);
+        if (entry) {
+            atomicAdd(entry->spamFreq, spamFreq);
+            atomicAdd(entry->hamFreq, hamFreq);
+            entry->updateScore();
+        }
+        else {
+            insertOrAdd(word, spamFreq, hamFreq, false);
+        }
+    }
+
+    ConcurrentWordFreq* search(string_view key) {
+        return searchHashed(key, hashCode(key));
+    }
+
+    ConcurrentWordFreq* searchHashed(string_view key, uint64_t hashVal) {
+        ReadGuard guard(epochs);
+        return find(table.load(), key, hashVal);
+    }
+
+    void prefetch(uint64_t hashVal) {
+        const void* bucket;
+        {
+            ReadGuard guard(epochs);
+            Table* t = table.load();
+            bucket = &t->buckets[hashVal & t->mask];
+        }
+        prefetchAddress(bucket);
+    }
+
+    void prefetchEntry(uint64_t hashVal) {
+        ReadGuard guard(epochs);
+        Table* t = table.load();
+        Link* link = t->buckets[hashVal & t->mask].load(memory_order_acquire);
+        if (link) {
+            prefetchAddress(link);
+        }
+    }
+
+    void finishRehash() {}
+
+    // Not safe while other threads use the map
+    void clear() {
+        Table* t = table.load();
+        for (size_t i = 0; i <= t->mask; i++) {
+            for (Link* link = t->buckets[i].load(memory_order_relaxed); link; link = link->next.load(memory_order_relaxed)) {
+                delete link->entry;
+            }
+        }
+        size_t size = t->mask + 1;
+        delete t;
+        table.store(new Table(size));
+        count = 0;
+    }
+
+    int getCount() const { return count.load(); }
+
+    double getLoadFactor() const {
+        return (double)count.load() / (double)(table.load()->mask + 1);
+    }
+
+    // Safe alongside lookups and inserts; words inserted meanwhile may or may
+    // not be counted
+    TableStats getStats() {
+        TableStats stats;
+        ReadGuard guard(epochs);
+        Table* t = table.load();
+        stats.buckets = t->mask + 1;
+        for (size_t i = 0; i <= t->mask; i++) {
+            size_t length = 0;
+            for (Link* link = t->buckets[i].load(memory_order_acquire); link; link = link->next.load(memory_order_acquire)) {
+                addToHistogram(stats.probeLengths, ++length);
+            }
+            addToHistogram(stats.chainLengths, length);
+            stats.words += length;
+            stats.usedBuckets += length > 0;
+        }
+        return stats;
+    }
+
+    size_t getRetiredCount() { return epochs.pendingCount(); }
+};
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef CORPUS_H
+#define CORPUS_H
+
+#include "hashmap.h"
+
+// How many times an email uses one vocabulary word
+struct WordCount {
+    uint32_t wordId;
+    uint32_t count;
+};
+
+// A labelled corpus stored sparsely: every distinct word is kept once in
+// vocabulary and each email is a run of (wordId, count) pairs in one shared
+// array, so memory grows with the number of distinct words per email rather
+// than with the number of tokens. Email i is
+// counts[emailStarts[i], emailStarts[i + 1]) and labels[i] is 1 for spam.
+struct SparseCorpus {
+    vector<string> vocabulary;
+    vector<WordCount> counts;
+    vector<size_t> emailStarts;
+    vector<char> labels;
+
+    SparseCorpus() : emailStarts(1, 0) {}
+
+    size_t size() const { return emailStarts.size() - 1; }
+    const WordCount* begin(size_t email) const { return counts.data() + emailStarts[email]; }
+    const WordCount* end(size_t email) const { return counts.data() + emailStarts[email + 1]; }
+
+    void clear() {
+        vocabulary.clear();
+        counts.clear();
+        emailStarts.assign(1, 0);
+        labels.clear();
+    }
+
+    // Heap bytes held by the corpus
+    size_t memoryUsage() const {
+        size_t bytes = vocabulary.capacity() * sizeof(string) + counts.capacity() * sizeof(WordCount) +
+                       emailStarts.capacity() * sizeof(size_t) + labels.capacity();
+        for (const string& word : vocabulary) {
+            if (word.capacity() > string().capacity()) {
+                bytes += word.capacity() + 1;
+            }
+        }
+        return bytes;
+    }
+};
+
+#endif
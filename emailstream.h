@@ -0,0 +1,343 @@
+#ifndef EMAILSTREAM_H
+#define EMAILSTREAM_H
+
+#include "hashmap.h"
+#include <cctype>
+#include <cstdio>
+
+// Splits a stream of emails into records without reading it all first. The
+// input is read in blocks of BLOCK_SIZE and every complete record in the
+// buffer is handed out as a pointer into it, so a caller can tokenize and
+// score a whole block at a time. Supported layouts:
+//   lines   one email per line
+//   ndjson  one JSON object per line; the email text is one string field
+//   mbox    messages separated by "From " lines; the Subject header and the
+//           body are the text, other headers are skipped
+
+enum EmailFormat { FORMAT_LINES, FORMAT_NDJSON, FORMAT_MBOX };
+
+inline bool parseEmailFormat(const string& name, EmailFormat& format) {
+    if (name == "lines") {
+        format = FORMAT_LINES;
+    }
+    else if (name == "ndjson") {
+        format = FORMAT_NDJSON;
+    }
+    else if (name == "mbox") {
+        format = FORMAT_MBOX;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+class EmailStreamReader {
+private:
+    enum { BLOCK_SIZE = 1 << 20 };
+
+    FILE* file;
+    EmailFormat format;
+    vector<char> data;
+    size_t begin;           //first byte not handed out yet
+    size_t end;             //end of the bytes read
+    bool atEnd;
+    bool readError;
+
+    bool nextLine(char*& record, size_t& length) {
+        char* p = data.data() + begin;
+        char* newline = (char*)memchr(p, '\n', end - begin);
+        if (newline) {
+            length = newline - p;
+            begin += length + 1;
+        }
+        else if (atEnd) {
+            length = end - begin;
+            begin = end;
+        }
+        else {
+            return false;
+        }
+        if (length > 0 && p[length - 1] == '\r') {
+            length--;
+        }
+        record = p;
+        return true;
+    }
+
+    // A message runs up to the next line that starts with "From "
+    bool nextMessage(char*& record, size_t& length) {
+        char* p = data.data() + begin;
+        char* stop = data.data() + end;
+        for (char* newline = (char*)memchr(p, '\n', stop - p); newline;
+             newline = (char*)memchr(newline + 1, '\n', stop - newline - 1)) {
+            if (stop - (newline + 1) < 5) {
+                if (!atEnd) {
+                    return false;
+                }
+                break;
+            }
+            if (memcmp(newline + 1, "From ", 5) == 0) {
+                record = p;
+                length = newline + 1 - p;
+                begin += length;
+                return true;
+            }
+        }
+        if (!atEnd) {
+            return false;
+        }
+        record = p;
+        length = stop - p;
+        begin = end;
+        return true;
+    }
+
+public:
+    EmailStreamReader(FILE* f, EmailFormat fmt)
+        : file(f), format(fmt), begin(0), end(0), atEnd(false), readError(false) {}
+
+    // Drops the records already handed out and reads the next block. Returns
+    // false once the input is used up and every record has been handed out.
+    bool fill() {
+        size_t kept = end - begin;
+        if (kept > 0 && begin > 0) {
+            memmove(data.data(), data.data() + begin, kept);
+        }
+        begin = 0;
+        end = kept;
+        if (!atEnd) {
+            if (data.size() < kept + BLOCK_SIZE) {
+                data.resize(kept + BLOCK_SIZE);
+            }
+            size_t got = fread(data.data() + end, 1, BLOCK_SIZE, file);
+            end += got;
+            if (got < BLOCK_SIZE) {
+                atEnd = true;
+                readError = ferror(file) != 0;
+            }
+        }
+        return end > 0;
+    }
+
+    // The next complete record in the buffer. It stays valid, and may be
+    // modified in place, until the next fill().
+    bool next(char*& record, size_t& length) {
+        if (begin == end) {
+            return false;
+        }
+        return format == FORMAT_MBOX ? nextMessage(record, length) : nextLine(record, length);
+    }
+
+    bool failed() const { return readError; }
+};
+
+// Returns the closing quote of the JSON string whose contents start at p, or end
+inline char* skipJsonString(char* p, char* end) {
+    while (p < end) {
+        if (*p == '\\') {
+            p += end - p >= 2 ? 2 : 1;
+        }
+        else if (*p == '"') {
+            return p;
+        }
+        else {
+            p++;
+        }
+    }
+    return end;
+}
+
+inline int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+// Reads the 4 hex digits of a \u escape at p, or returns -1
+inline long readJsonCodeUnit(const char* p, const char* end) {
+    if (end - p < 4) {
+        return -1;
+    }
+    long value = 0;
+    for (int i = 0; i < 4; i++) {
+        int digit = hexValue(p[i]);
+        if (digit < 0) {
+            return -1;
+        }
+        value = value * 16 + digit;
+    }
+    return value;
+}
+
+inline char* putUtf8(char* out, unsigned long codePoint) {
+    if (codePoint < 0x80) {
+        *out++ = (char)codePoint;
+    }
+    else if (codePoint < 0x800) {
+        *out++ = (char)(0xc0 | (codePoint >> 6));
+        *out++ = (char)(0x80 | (codePoint & 0x3f));
+    }
+    else if (codePoint < 0x10000) {
+        *out++ = (char)(0xe0 | (codePoint >> 12));
+        *out++ = (char)(0x80 | ((codePoint >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (codePoint & 0x3f));
+    }
+    else {
+        *out++ = (char)(0xf0 | (codePoint >> 18));
+        *out++ = (char)(0x80 | ((codePoint >> 12) & 0x3f));
+        *out++ = (char)(0x80 | ((codePoint >> 6) & 0x3f));
+        *out++ = (char)(0x80 | (codePoint & 0x3f));
+    }
+    return out;
+}
+
+// Decodes the JSON string whose contents start at p over itself (the decoded
+// text is never longer) and returns where the decoded text ends. Escapes the
+// tokenizer would treat as separators anyway become spaces.
+inline char* decodeJsonString(char* p, char* end) {
+    char* out = p;
+    while (p < end && *p != '"') {
+        if (*p != '\\') {
+            *out++ = *p++;
+            continue;
+        }
+        if (end - p < 2) {
+            break;
+        }
+        char escape = p[1];
+        p += 2;
+        if (escape == '"' || escape == '\\' || escape == '/') {
+            *out++ = escape;
+        }
+        else if (escape == 'u') {
+            long unit = readJsonCodeUnit(p, end);
+            if (unit < 0) {
+                *out++ = ' ';
+                continue;
+            }
+            p += 4;
+            unsigned long codePoint = (unsigned long)unit;
+            if (unit >= 0xd800 && unit < 0xdc00 && end - p >= 6 && p[0] == '\\' && p[1] == 'u') {
+                long low = readJsonCodeUnit(p + 2, end);
+                if (low >= 0xdc00 && low < 0xe000) {
+                    codePoint = 0x10000 + (((unsigned long)unit - 0xd800) << 10) + ((unsigned long)low - 0xdc00);
+                    p += 6;
+                }
+            }
+            if (codePoint >= 0xd800 && codePoint < 0xe000) {
+                *out++ = ' ';
+            }
+            else {
+                out = putUtf8(out, codePoint);
+            }
+        }
+        else {
+            *out++ = ' ';
+        }
+    }
+    return out;
+}
+
+// Finds the string field key of the JSON object in [begin, end) and decodes
+// it in place. Only fields of the outermost object count.
+inline bool findJsonStringField(char* begin, char* end, string_view key, char*& value, size_t& length) {
+    int depth = 0;
+    for (char* p = begin; p < end; p++) {
+        if (*p == '{' || *p == '[') {
+            depth++;
+        }
+        else if (*p == '}' || *p == ']') {
+            depth--;
+        }
+        else if (*p == '"') {
+            char* start = p + 1;
+            char* close = skipJsonString(start, end);
+            if (close == end) {
+                return false;
+            }
+            p = close;
+
+            char* next = close + 1;
+            while (next < end && isspace((unsigned char)*next)) {
+                next++;
+            }
+            if (depth != 1 || next == end || *next != ':' || string_view(start, close - start) != key) {
+                continue;
+            }
+            next++;
+            while (next < end && isspace((unsigned char)*next)) {
+                next++;
+            }
+            if (next == end || *next != '"') {
+                return false;
+            }
+            value = next + 1;
+            length = decodeJsonString(value, end) - value;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool startsWithIgnoringCase(const char* text, size_t length, const char* prefix) {
+    size_t i = 0;
+    for (; prefix[i]; i++) {
+        if (i == length || tolower((unsigned char)text[i]) != prefix[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Splits an mbox message into its Subject header value and its body,
+// skipping the "From " line and every other header. Both stay in place.
+inline void splitMboxMessage(char* message, size_t length, char*& subject, size_t& subjectLength,
+                             char*& body, size_t& bodyLength) {
+    char* p = message;
+    char* end = message + length;
+    if (end - p >= 5 && memcmp(p, "From ", 5) == 0) {
+        char* newline = (char*)memchr(p, '\n', end - p);
+        p = newline ? newline + 1 : end;
+    }
+
+    bool inSubject = false;
+    char* subjectStart = nullptr;
+    char* subjectEnd = nullptr;
+    while (p < end) {
+        char* newline = (char*)memchr(p, '\n', end - p);
+        char* lineEnd = newline ? newline : end;
+        size_t lineLength = lineEnd - p;
+        if (lineLength == 0 || (lineLength == 1 && *p == '\r')) {
+            p = newline ? newline + 1 : end;
+            break;
+        }
+        if (*p == ' ' || *p == '\t') {
+            // A continuation of the previous header
+            if (inSubject) {
+                subjectEnd = lineEnd;
+            }
+        }
+        else {
+            inSubject = startsWithIgnoringCase(p, lineLength, "subject:");
+            if (inSubject) {
+                subjectStart = p + 8;
+                subjectEnd = lineEnd;
+            }
+        }
+        p = newline ? newline + 1 : end;
+    }
+    subject = subjectStart;
+    subjectLength = subjectStart ? subjectEnd - subjectStart : 0;
+    body = p;
+    bodyLength = end - p;
+}
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "classifier.h"
+#include "tokenizer.h"
+#include <memory>
+
+// The classifier without the GUI: loads a model into the chosen map, or maps
+// a compiled model, and scores email text or pre-tokenized batches. This is
+// what a program embedding the classifier includes; the GTK window and the
+// command line tool are both thin layers over the same headers.
+class SpamEngine {
+private:
+    unique_ptr<HashMap> wordMap;
+    CompiledModel compiledModel;
+    unique_ptr<WordAutomaton> automaton;
+    unique_ptr<QuantizedModel> quantizedModel;
+    unique_ptr<EmailClassifier> classifier;
+    double threshold;
+    vector<string_view> tokens;     //reused by scoreText
+
+    template <class Map>
+    bool loadMap(const string& modelFile) {
+        Map* map = new Map(2000);
+        wordMap.reset(map);
+        if (!loadWordFrequenciesFromTransposedCSV(modelFile, map)) {
+            wordMap.reset();
+            return false;
+        }
+        classifier.reset(new EmailClassifier(map, threshold));
+        return true;
+    }
+
+    template <class Map>
+    bool loadBackend(const string& modelFile, bool prefilter) {
+        return prefilter ? loadMap<PrefilteredMap<Map>>(modelFile) : loadMap<Map>(modelFile);
+    }
+
+public:
+    SpamEngine() : threshold(0.7) {}
+
+    SpamEngine(const SpamEngine&) = delete;
+    SpamEngine& operator=(const SpamEngine&) = delete;
+
+    // A file ending in ".model" is mapped as a compiled model. Any other file
+    // is read as the transposed CSV into the map named by backend: "flat",
+    // "chaining", "open", "arena" or "perfect", compiled into a WordAutomaton
+    // for "automaton", or rounded into a QuantizedModel with 16-bit scores
+    // for "quantized" and 8-bit ones for "quantized8". With prefilter the map
+    // gets a Bloom filter in front of it (see PrefilteredMap); the automaton
+    // and the quantized model ignore it.
+    bool open(const string& modelFile, const string& backend = "flat", double thresh = 0.7, bool prefilter = false) {
+        close();
+        threshold = thresh;
+
+        bool compiled = modelFile.size() >= 6 && modelFile.compare(modelFile.size() - 6, 6, ".model") == 0;
+        if (compiled) {
+            if (!compiledModel.open(modelFile)) {
+                return false;
+            }
+            classifier.reset(new EmailClassifier(&compiledModel, threshold));
+            return true;
+        }
+
+        if (backend == "flat") {
+            return loadBackend<FlatHashMap>(modelFile, prefilter);
+        }
+        if (backend == "chaining") {
+            return loadBackend<ChainingHashMap>(modelFile, prefilter);
+        }
+        if (backend == "open") {
+            return loadBackend<OpenAddressingHashMap>(modelFile, prefilter);
+        }
+        if (backend == "arena") {
+            return loadBackend<ArenaChainingHashMap>(modelFile, prefilter);
+        }
+        if (backend == "perfect") {
+            return loadBackend<PerfectHashMap>(modelFile, prefilter);
+        }
+        if (backend == "automaton") {
+            automaton.reset(new WordAutomaton(2000));
+            if (!loadWordFrequenciesFromTransposedCSV(modelFile, automaton.get())) {
+                automaton.reset();
+                return false;
+            }
+            classifier.reset(new EmailClassifier(automaton.get(), threshold));
+            return true;
+        }
+        if (backend == "quantized" || backend == "quantized8") {
+            quantizedModel.reset(new QuantizedModel(2000, backend == "quantized8" ? 8 : 16));
+            if (!loadWordFrequenciesFromTransposedCSV(modelFile, quantizedModel.get())) {
+                quantizedModel.reset();
+                return false;
+            }
+            classifier.reset(new EmailClassifier(quantizedModel.get(), threshold));
+            return true;
+        }
+        cerr << "Error: unknown map " << backend << endl;
+        return false;
+    }
+
+    void close() {
+        classifier.reset();
+        wordMap.reset();
+        automaton.reset();
+        quantizedModel.reset();
+        compiledModel.close();
+    }
+
+    bool isOpen() const { return classifier != nullptr; }
+
+    // True when scoreText reads the text in one pass instead of tokenizing
+    // it, so callers holding raw text should pass it whole
+    bool scansText() const { return automaton != nullptr; }
+
+    // Returns the score of text[0, length); see BasicEmailClassifier::score.
+    // The maps tokenize it in place, lowercasing it; the automaton leaves it
+    // as it is.
+    double scoreText(char* text, size_t length) {
+        if (automaton) {
+            return classifier->scoreText(text, length);
+        }
+        tokens.clear();
+        tokenizeInPlace(text, length, [&](string_view token) {
+            tokens.push_back(token);
+        });
+        return classifier->score(tokens);
+    }
+
+    // Emails stored back to back in one token stream, as for classifyBatch
+    void scoreBatch(const vector<string_view>& tokenStream, const vector<size_t>& emailEnds, vector<double>& scores) {
+        classifier->scoreBatch(tokenStream, emailEnds, scores);
+    }
+
+    bool isSpamScore(double score) const {
+        return score >= 0 && score >= threshold;
+    }
+
+    void setStats(ClassifierStats* stats) {
+        classifier->setStats(stats);
+    }
+
+    TableStats getTableStats() {
+        if (automaton) {
+            return automaton->getStats();
+        }
+        if (quantizedModel) {
+            return quantizedModel->getStats();
+        }
+        return wordMap ? wordMap->getStats() : compiledModel.getStats();
+    }
+
+    int getCount() {
+        if (automaton) {
+            return automaton->getCount();
+        }
+        if (quantizedModel) {
+            return quantizedModel->getCount();
+        }
+        return wordMap ? wordMap->getCount() : compiledModel.getCount();
+    }
+};
+
+#endif
@@ -0,0 +1,52 @@
+#include "scoring.h"
+#include <cstdlib>
+
+// Accuracy report for the quantized models: scores every email of the
+// labelled per-email dataset with the full-precision model and with 16-bit
+// and 8-bit quantized copies of it, and prints the accuracy of each, the
+// change against full precision and the table size.
+//   evaluate [dataset.csv] [model.csv] [threshold] [threads]
+int main(int argc, char *argv[]) {
+    string datasetFile = argc > 1 ? argv[1] : "emails.csv";
+    string modelFile = argc > 2 ? argv[2] : "final.csv";
+    double threshold = argc > 3 ? atof(argv[3]) : 0.7;
+    int threads = argc > 4 ? atoi(argv[4]) : 0;
+
+    // The last header column is the label, not a word
+    vector<string> headerWords = readHeader(datasetFile);
+    if (headerWords.empty()) {
+        cerr << "Error: No header in " << datasetFile << endl;
+        return 1;
+    }
+    headerWords.pop_back();
+
+    SparseCorpus corpus;
+    if (!readSparseDataset(datasetFile, headerWords, corpus, threads) || corpus.size() == 0) {
+        cerr << "Error: No emails in " << datasetFile << endl;
+        return 1;
+    }
+
+    FlatHashMap fullMap(2000);
+    QuantizedModel model16(2000, 16), model8(2000, 8);
+    if (!loadWordFrequenciesFromTransposedCSV(modelFile, &fullMap) ||
+        !loadWordFrequenciesFromTransposedCSV(modelFile, &model16) ||
+        !loadWordFrequenciesFromTransposedCSV(modelFile, &model8)) {
+        cerr << "Failed to load the model from " << modelFile << endl;
+        return 1;
+    }
+
+    vector<double> fullScores, scores16, scores8;
+    AccuracyReport full = measureAccuracy(&fullMap, corpus, threshold, fullScores);
+    AccuracyReport quantized16 = measureAccuracy(&model16, corpus, threshold, scores16, &fullScores);
+    AccuracyReport quantized8 = measureAccuracy(&model8, corpus, threshold, scores8, &fullScores);
+
+    cout << corpus.size() << " emails from " << datasetFile << ", " << fullMap.getCount() << " words from "
+         << modelFile << ", threshold " << threshold << endl;
+    printAccuracyReport(cout, "Full precision", full);
+    printAccuracyReport(cout, "16-bit scores", quantized16, &full);
+    printAccuracyReport(cout, "8-bit scores", quantized8, &full);
+    // A Flat slot is a WordFreq plus one control byte; long words also have a heap block
+    size_t flatBytes = fullMap.getStats().buckets * (sizeof(WordFreq) + 1);
+    cout << "Table bytes: " << flatBytes << " full precision (Flat), " << model16.getBytes() << " quantized" << endl;
+    return 0;
+}
@@ -0,0 +1,348 @@
+#ifndef FEEDBACK_H
+#define FEEDBACK_H
+
+#include "hashmap.h"
+#include "concurrentmap.h"
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+// Labelled feedback is kept in an append-only log next to the model instead
+// of being written into the model CSV. Each record is a list of
+// (word, spam count, ham count) and starts with its length and a checksum,
+// so a record cut short by a crash is recognised and dropped. Compaction
+// folds the whole log into one record per word and renames it into place,
+// so replaying the log costs the same however many emails were reported.
+//
+// Log layout, native byte order like the compiled model:
+//   header: magic "SPAMFBK\0", uint32 version
+//   record: uint32 payloadSize, uint32 checksum of the payload,
+//           payload: uint32 wordCount, then per word
+//                    uint32 spamCount, uint32 hamCount, uint16 length, bytes
+
+#define FEEDBACK_LOG_MAGIC "SPAMFBK"
+
+enum { FEEDBACK_LOG_VERSION = 1 };
+
+struct FeedbackWord {
+    string word;
+    uint32_t spamCount;
+    uint32_t hamCount;
+};
+
+// FNV-1a; only has to catch torn or garbled records
+inline uint32_t feedbackChecksum(const char* data, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h ^= (unsigned char)data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// One entry per distinct word of a reported email, counting repeats
+inline vector<FeedbackWord> countFeedbackWords(vector<string_view> words, bool spam) {
+    sort(words.begin(), words.end());
+    vector<FeedbackWord> counted;
+    for (size_t i = 0; i < words.size();) {
+        size_t j = i;
+        while (j < words.size() && words[j] == words[i]) {
+            j++;
+        }
+        if (words[i].size() <= 0xffff) {
+            FeedbackWord fw = {string(words[i]), spam ? (uint32_t)(j - i) : 0u, spam ? 0u : (uint32_t)(j - i)};
+            counted.push_back(fw);
+        }
+        i = j;
+    }
+    return counted;
+}
+
+// Adds feedback counts to a map, inserting words the model has not seen.
+// Only one thread may use wordMap meanwhile.
+inline void applyFeedback(HashMap* wordMap, const FeedbackWord& feedback) {
+    WordFreq* wf = wordMap->search(feedback.word);
+    if (wf) {
+        wf->addCounts(feedback.spamCount, feedback.hamCount);
+    }
+    else {
+        wordMap->insert(WordFreq(feedback.word, feedback.spamCount, feedback.hamCount));
+    }
+}
+
+// Safe while other threads classify with wordMap
+inline void applyFeedback(ConcurrentHashMap* wordMap, const FeedbackWord& feedback) {
+    wordMap->addCounts(feedback.word, feedback.spamCount, feedback.hamCount);
+}
+
+class FeedbackLog {
+private:
+    enum { HEADER_SIZE = 12, RECORD_HEADER_SIZE = 8 };
+
+    mutex lock;             //guards the file and the counters below
+    mutex compactionLock;   //one compaction at a time
+    string filename;
+    FILE* file;
+    uint64_t sequence;      //records appended since open
+    size_t fileSize;
+    size_t recordsInFile;
+
+    static void putBytes(string& out, const void* data, size_t length) {
+        out.append((const char*)data, length);
+    }
+
+    static string encodeRecord(const vector<FeedbackWord>& words) {
+        string payload;
+        uint32_t wordCount = (uint32_t)words.size();
+        putBytes(payload, &wordCount, sizeof(wordCount));
+        for (const FeedbackWord& fw : words) {
+            uint16_t length = (uint16_t)fw.word.size();
+            putBytes(payload, &fw.spamCount, sizeof(fw.spamCount));
+            putBytes(payload, &fw.hamCount, sizeof(fw.hamCount));
+            putBytes(payload, &length, sizeof(length));
+            payload += fw.word;
+        }
+
+        string record;
+        uint32_t payloadSize = (uint32_t)payload.size();
+        uint32_t checksum = feedbackChecksum(payload.data(), payload.size());
+        putBytes(record, &payloadSize, sizeof(payloadSize));
+        putBytes(record, &checksum, sizeof(checksum));
+        return record + payload;
+    }
+
+    static string encodeHeader() {
+        string header(FEEDBACK_LOG_MAGIC, 8);
+        uint32_t version = FEEDBACK_LOG_VERSION;
+        putBytes(header, &version, sizeof(version));
+        return header;
+    }
+
+    // Calls onWord for every word of the valid records in data[begin, end) and
+    // returns where the valid records stop
+    static size_t decodeRecords(const string& data, size_t begin, size_t end, size_t& records,
+                                const function<void(string_view, uint32_t, uint32_t)>& onWord) {
+        size_t pos = begin;
+        records = 0;
+        while (pos + RECORD_HEADER_SIZE <= end) {
+            uint32_t payloadSize, checksum;
+            memcpy(&payloadSize, &data[pos], sizeof(payloadSize));
+            memcpy(&checksum, &data[pos + 4], sizeof(checksum));
+            size_t payloadStart = pos + RECORD_HEADER_SIZE;
+            if (payloadSize < 4 || payloadSize > end - payloadStart ||
+                feedbackChecksum(&data[payloadStart], payloadSize) != checksum) {
+                break;
+            }
+
+            // The checksum matched, so the words are in bounds unless the
+            // writer was broken; check anyway rather than trust the file
+            const char* p = &data[payloadStart];
+            const char* payloadEnd = p + payloadSize;
+            uint32_t wordCount;
+            memcpy(&wordCount, p, sizeof(wordCount));
+            p += 4;
+            bool valid = true;
+            for (uint32_t w = 0; w < wordCount && valid; w++) {
+                uint32_t spamCount, hamCount;
+                uint16_t length;
+                if (payloadEnd - p < 10) {
+                    valid = false;
+                    break;
+                }
+                memcpy(&spamCount, p, 4);
+                memcpy(&hamCount, p + 4, 4);
+                memcpy(&length, p + 8, 2);
+                p += 10;
+                if (payloadEnd - p < length) {
+                    valid = false;
+                    break;
+                }
+                if (onWord) {
+                    onWord(string_view(p, length), spamCount, hamCount);
+                }
+                p += length;
+            }
+            if (!valid) {
+                break;
+            }
+            records++;
+            pos = payloadStart + payloadSize;
+        }
+        return pos;
+    }
+
+    static bool readWholeFile(const string& name, string& data) {
+        ifstream in(name, ios::binary);
+        if (!in.is_open()) {
+            return false;
+        }
+        ostringstream contents;
+        contents << in.rdbuf();
+        data = contents.str();
+        return true;
+    }
+
+    bool reopenForAppend() {
+        file = fopen(filename.c_str(), "ab");
+        if (!file) {
+            cerr << "Error opening feedback log for writing: " << filename << endl;
+            return false;
+        }
+        return true;
+    }
+
+public:
+    enum { COMPACT_AFTER_RECORDS = 64 };
+
+    FeedbackLog() : file(nullptr), sequence(0), fileSize(0), recordsInFile(0) {}
+
+    ~FeedbackLog() {
+        close();
+    }
+
+    FeedbackLog(const FeedbackLog&) = delete;
+    FeedbackLog& operator=(const FeedbackLog&) = delete;
+
+    // Opens or creates the log. A torn record at the end is cut off here so
+    // that new records are appended after the last good one.
+    bool open(const string& logFile) {
+        close();
+        lock_guard<mutex> guard(lock);
+        filename = logFile;
+
+        string data;
+        if (!readWholeFile(filename, data) || data.empty()) {
+            data = encodeHeader();
+            if (!replaceFileContents(filename, data)) {
+                return false;
+            }
+        }
+        if (data.size() < HEADER_SIZE || data.compare(0, HEADER_SIZE, encodeHeader()) != 0) {
+            cerr << "Error: " << filename << " is not a compatible feedback log" << endl;
+            return false;
+        }
+
+        size_t validEnd = decodeRecords(data, HEADER_SIZE, data.size(), recordsInFile, nullptr);
+        if (validEnd != data.size()) {
+            cerr << "Feedback log " << filename << ": dropping " << data.size() - validEnd
+                 << " bytes of an incomplete record" << endl;
+            data.resize(validEnd);
+            if (!replaceFileContents(filename, data)) {
+                return false;
+            }
+        }
+        fileSize = validEnd;
+        return reopenForAppend();
+    }
+
+    void close() {
+        lock_guard<mutex> guard(lock);
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    // Appends one record and returns its sequence number (from 1), or 0 if
+    // it could not be written
+    uint64_t append(const vector<FeedbackWord>& words) {
+        string record = encodeRecord(words);
+        lock_guard<mutex> guard(lock);
+        if (!file) {
+            return 0;
+        }
+        if (fwrite(record.data(), 1, record.size(), file) != record.size() || fflush(file) != 0) {
+            cerr << "Error writing feedback log: " << filename << endl;
+            return 0;
+        }
+        fileSize += record.size();
+        recordsInFile++;
+        return ++sequence;
+    }
+
+    // Calls onWord(word, spamCount, hamCount) for every word in the log and
+    // returns the sequence number of the last record it included
+    uint64_t replay(const function<void(string_view, uint32_t, uint32_t)>& onWord) {
+        lock_guard<mutex> guard(lock);
+        string data;
+        size_t records;
+        if (readWholeFile(filename, data) && data.size() >= fileSize) {
+            decodeRecords(data, HEADER_SIZE, fileSize, records, onWord);
+        }
+        return sequence;
+    }
+
+    bool needsCompaction() {
+        lock_guard<mutex> guard(lock);
+        return recordsInFile > COMPACT_AFTER_RECORDS;
+    }
+
+    // Replaces the log with a single record holding the summed counts of every
+    // word. Appends only wait while the records written during the compaction
+    // are copied over and the new file is renamed into place.
+    bool compact() {
+        lock_guard<mutex> compacting(compactionLock);
+        size_t boundary;
+        {
+            lock_guard<mutex> guard(lock);
+            if (!file) {
+                return false;
+            }
+            boundary = fileSize;
+        }
+
+        // Nothing but compaction rewrites the first `boundary` bytes
+        string data;
+        if (!readWholeFile(filename, data) || data.size() < boundary) {
+            return false;
+        }
+        vector<FeedbackWord> totals;
+        unordered_map<string, size_t> positions;
+        size_t records;
+        decodeRecords(data, HEADER_SIZE, boundary, records, [&](string_view word, uint32_t spamCount, uint32_t hamCount) {
+            auto inserted = positions.insert(make_pair(string(word), totals.size()));
+            if (inserted.second) {
+                FeedbackWord fw = {string(word), 0, 0};
+                totals.push_back(fw);
+            }
+            FeedbackWord& total = totals[inserted.first->second];
+            total.spamCount = (uint32_t)min<uint64_t>((uint64_t)total.spamCount + spamCount, UINT32_MAX);
+            total.hamCount = (uint32_t)min<uint64_t>((uint64_t)total.hamCount + hamCount, UINT32_MAX);
+        });
+        string compacted = encodeHeader();
+        size_t compactedRecords = 0;
+        if (!totals.empty()) {
+            compacted += encodeRecord(totals);
+            compactedRecords = 1;
+        }
+
+        lock_guard<mutex> guard(lock);
+        if (!readWholeFile(filename, data) || data.size() < fileSize) {
+            return false;
+        }
+        size_t tailRecords = recordsInFile - records;
+        compacted.append(data, boundary, fileSize - boundary);
+
+        fclose(file);
+        file = nullptr;
+        bool replaced = replaceFileContents(filename, compacted);
+        if (replaced) {
+            fileSize = compacted.size();
+            recordsInFile = compactedRecords + tailRecords;
+        }
+        return reopenForAppend() && replaced;
+    }
+
+    uint64_t getSequence() {
+        lock_guard<mutex> guard(lock);
+        return sequence;
+    }
+
+    size_t getRecordCount() {
+        lock_guard<mutex> guard(lock);
+        return recordsInFile;
+    }
+};
+
+#endif
@@ -1,316 +1,1222 @@
-#include <iostream>
-#include <string>
-#include <vector>
-#include <list>
-#include <fstream>
-#include <sstream>
-#include <cmath>
-using namespace std;
-
-struct WordFreq {
-    string word;
-    double spamFreq;
-    double hamFreq;
-    
-    WordFreq(string w = "", double s = 0.0, double h = 0.0) 
-        : word(w), spamFreq(s), hamFreq(h) {}
-};
+#include "classifier.h"
+#include "feedback.h"
+#include "scoring.h"
+#include "tokenizer.h"
+#include <chrono>
+#include <cstdlib>
+#include <new>
 
-struct Node {
-    WordFreq data;
-    Node* next;
-    
-    Node(WordFreq d) : data(d), next(nullptr) {}
-};
 
-class HashMap {
-protected:
-    int size;
-    int count;
-    
-    int hash(string key) {
-        int hashVal = 0;
-        for(char c : key) {
-            hashVal = 37 * hashVal + c;
-        }
-        return abs(hashVal) % size;
-    }
-    
-public:
-    HashMap(int s = 997) : size(s), count(0) {}
-    virtual ~HashMap() {}
-    
-    virtual void insert(WordFreq data) = 0;
-    virtual WordFreq* search(string key) = 0;
-    virtual void clear() = 0;
-    
-    double getLoadFactor() { return (double)count / size; }
-    int getCount() { return count; }
-};
+// Every heap allocation in this program goes through here, so main can check
+// that classifying an email never allocates
+size_t allocationCount = 0;
 
-// Chaining implementation
-class ChainingHashMap : public HashMap {
-private:
-    vector<Node*> table;
-    
-public:
-    ChainingHashMap(int s = 997) : HashMap(s) {
-        table.resize(size, nullptr);
-    }
-    
-    ~ChainingHashMap() {
-        clear();
-    }
-    
-    void insert(WordFreq data) override {
-        int index = hash(data.word);
-        Node* newNode = new Node(data);
-        
-        if(!table[index]) {
-            table[index] = newNode;
-            count++;
-            return;
-        }
-        
-        Node* current = table[index];
-        while(current->next) {
-            if(current->data.word == data.word) {
-                current->data = data;
-                delete newNode;
-                return;
-            }
-            current = current->next;
-        }
-        
-        if(current->data.word == data.word) {
-            current->data = data;
-            delete newNode;
-            return;
-        }
-        
-        current->next = newNode;
-        count++;
-    }
-    
-    WordFreq* search(string key) override {
-        int index = hash(key);
-        Node* current = table[index];
-        
-        while(current) {
-            if(current->data.word == key) {
-                return &(current->data);
-            }
-            current = current->next;
-        }
-        return nullptr;
-    }
-    
-    void clear() override {
-        for(Node* head : table) {
-            while(head) {
-                Node* temp = head;
-                head = head->next;
-                delete temp;
-            }
-        }
-        table.clear();
-        count = 0;
+void* operator new(size_t n) {
+    allocationCount++;
+    void* p = malloc(n ? n : 1);
+    if (!p) {
+        throw bad_alloc();
     }
-};
+    return p;
+}
 
-class OpenAddressingHashMap : public HashMap {
-private:
-    vector<pair<bool, WordFreq>> table;  
-    
-public:
-    OpenAddressingHashMap(int s = 997) : HashMap(s) {
-        table.resize(size, {false, WordFreq()});
-    }
-    
-    void insert(WordFreq data) override {
-        int index = hash(data.word);
-        int i = 0;
-        
-        while(i < size) {
-            int currentIndex = (index + i) % size;
-            
-            if(!table[currentIndex].first) {
-                table[currentIndex] = {true, data};
-                count++;
-                return;
-            }
-            else if(table[currentIndex].second.word == data.word) {
-                table[currentIndex].second = data;
-                return;
-            }
-            i++;
-        }
-        // Table is full
-        cout << "Hash table is full!" << endl;
-    }
-    
-    WordFreq* search(string key) override {
-        int index = hash(key);
-        int i = 0;
-        
-        while(i < size) {
-            int currentIndex = (index + i) % size;
-            
-            if(!table[currentIndex].first) {
-                return nullptr;
-            }
-            if(table[currentIndex].second.word == key) {
-                return &(table[currentIndex].second);
-            }
-            i++;
-        }
-        return nullptr;
-    }
-    
-    void clear() override {
-        table.clear();
-        table.resize(size, {false, WordFreq()});
-        count = 0;
+// GCC sees operator new inlined next to free() and warns about a mismatch
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+typedef vector<pair<string, vector<string>>> TestEmails;
+
+void testClassifier(const string& name, EmailClassifier& classifier, const TestEmails& testEmails) {
+    cout << "\nTesting " << name << " Implementation:" << endl;
+    int correctPredictions = 0;
+    for(const auto& email : testEmails) {
+        bool prediction = classifier.classify(email.second);
+        bool actual = (email.first == "spam");
+        cout << "Predicted: " << (prediction ? "spam" : "ham") << ", Actual: " << email.first << endl;
+        if(prediction == actual) correctPredictions++;
     }
-};
+    cout << "Accuracy: " << (double)correctPredictions/testEmails.size() * 100 << "%" << endl;
+}
 
-// Email Classifier class
-class EmailClassifier {
-private:
-    HashMap* wordMap;
-    double threshold;
-    
-public:
-    EmailClassifier(HashMap* map, double thresh = 0.7) 
-        : wordMap(map), threshold(thresh) {}
-
-    
-    bool classify(const vector<string>& emailWords) {
-        double spamScore = 0.0;
-        double totalWords = 0.0;
-        
-        for(const string& word : emailWords) {
-            WordFreq* wf = wordMap->search(word);
-            if(wf) {
-                double totalFreq = wf->spamFreq + wf->hamFreq;
-                if(totalFreq > 0) {
-                    spamScore += (wf->spamFreq / totalFreq);
-                    totalWords += 1.0;
-                }
+// Returns how many heap allocations one classify call made
+size_t countClassifyAllocations(EmailClassifier& classifier, const vector<string_view>& emailWords) {
+    size_t before = allocationCount;
+    classifier.classify(emailWords);
+    return allocationCount - before;
+}
+
+// Looks up every key rounds times and returns the average time per lookup in ns
+template <class Map>
+double timeLookups(Map* map, const vector<string>& keys, int rounds, int& found) {
+    found = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (const string& key : keys) {
+            if (map->search(key)) {
+                found++;
             }
         }
-        
-        return (totalWords > 0 && (spamScore / totalWords) >= threshold);
     }
-};
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, nano>(end - start).count() / ((double)keys.size() * rounds);
+}
+
+// Bucket occupancy and probe lengths that words would get in a table of
+// tableSize slots under hashFunction
+void printHashDistribution(const string& name, HashFunction hashFunction, const vector<string>& words, int tableSize) {
+    int mask = tableSize - 1;
+
+    vector<int> chainLengths(tableSize, 0);
+    for (const string& word : words) {
+        chainLengths[hashFunction(word) & mask]++;
+    }
+    int usedBuckets = 0, longestChain = 0;
+    for (int length : chainLengths) {
+        if (length > 0) {
+            usedBuckets++;
+        }
+        longestChain = max(longestChain, length);
+    }
 
-vector<string> splitCSVLine(const string& line) {
-    vector<string> tokens;
-    stringstream ss(line);
-    string token;
-    
-    while (getline(ss, token, ',')) {
-        
-        if (!token.empty() && token.front() == '"' && token.back() == '"') {
-            token = token.substr(1, token.length() - 2);
-        }
-        
-        
-        tokens.push_back(token);
-    }
-    return tokens;
+    // Probe length = slots visited to place the word with linear probing
+    vector<bool> usedSlots(tableSize, false);
+    int longestProbe = 0;
+    double totalProbe = 0;
+    for (const string& word : words) {
+        int index = (int)(hashFunction(word) & mask);
+        int probe = 1;
+        while (usedSlots[index]) {
+            index = (index + 1) & mask;
+            probe++;
+        }
+        usedSlots[index] = true;
+        longestProbe = max(longestProbe, probe);
+        totalProbe += probe;
+    }
+
+    cout << name << " (" << tableSize << " slots): " << usedBuckets << " buckets used, longest chain "
+         << longestChain << ", longest linear probe " << longestProbe << ", average probe "
+         << totalProbe / words.size() << endl;
 }
 
-void loadWordFrequenciesFromTransposedCSV(const string& filename, HashMap* wordMap) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Error opening file: " << filename << endl;
-        return;
+// Classifies tokens rounds times and returns millions of tokens per second
+template <class Classifier>
+double millionTokensPerSecond(const Classifier& classifier, const vector<string_view>& tokens, int rounds) {
+    int spamVotes = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        if (classifier.classify(tokens)) {
+            spamVotes++;
+        }
     }
+    auto end = chrono::steady_clock::now();
+    if (spamVotes < 0) {
+        cout << spamVotes;     //keeps the loop from being optimised away
+    }
+    return (double)tokens.size() * rounds / chrono::duration<double, micro>(end - start).count();
+}
 
-    string wordsLine, spamLine, hamLine;
-    getline(file, wordsLine);
-    getline(file, spamLine);
-    getline(file, hamLine);
+template <class Map>
+void compareDispatch(const string& name, Map* map, const vector<string_view>& tokens, int rounds) {
+    BasicEmailClassifier<HashMap> virtualClassifier(map);
+    BasicEmailClassifier<Map> staticClassifier(map);
+    cout << name << ": virtual " << millionTokensPerSecond(virtualClassifier, tokens, rounds)
+         << " M tokens/s, static " << millionTokensPerSecond(staticClassifier, tokens, rounds) << " M tokens/s" << endl;
+}
 
-    vector<string> words = splitCSVLine(wordsLine);
-    vector<string> spamCounts = splitCSVLine(spamLine);
-    vector<string> hamCounts = splitCSVLine(hamLine);
+// A slice of a token vector that classify can iterate without copying it
+struct TokenRange {
+    const string_view* first;
+    const string_view* last;
 
-    if (words.size() != spamCounts.size() || words.size() != hamCounts.size()) {
-        cerr << "Error: Inconsistent number of columns in CSV file" << endl;
-        cerr << "Words: " << words.size() << ", Spam counts: " << spamCounts.size() << ", Ham counts: " << hamCounts.size() << endl;
-        return;
+    const string_view* begin() const { return first; }
+    const string_view* end() const { return last; }
+};
+
+// Times scoring every email with score() vs one scoreBatch() call. Both read
+// every token, so the difference is the batch loop and its prefetching.
+// Also checks that both give the same scores, and that classifyBatch agrees
+// with classify(), which can stop early; returns false if not.
+template <class Map>
+bool compareBatch(const string& name, Map* map, const vector<string_view>& tokens, const vector<size_t>& emailEnds, int rounds) {
+    BasicEmailClassifier<Map> classifier(map);
+    vector<double> singleScores(emailEnds.size()), batchScores;
+    vector<bool> singleVerdicts(emailEnds.size()), batchVerdicts;
+
+    auto singleStart = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        size_t begin = 0;
+        for (size_t e = 0; e < emailEnds.size(); e++) {
+            TokenRange email = {tokens.data() + begin, tokens.data() + emailEnds[e]};
+            singleScores[e] = classifier.score(email);
+            begin = emailEnds[e];
+        }
     }
+    auto singleEnd = chrono::steady_clock::now();
 
-    for (size_t i = 0; i < words.size(); ++i) {
-        try {
-            
-            if (words[i].empty() || words[i] == "Word" || words[i] == "word") {
-                continue;
-            }
+    auto batchStart = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        classifier.scoreBatch(tokens, emailEnds, batchScores);
+    }
+    auto batchEnd = chrono::steady_clock::now();
 
-            double spamFreq = stod(spamCounts[i]);
-            double hamFreq = stod(hamCounts[i]);
+    size_t begin = 0;
+    for (size_t e = 0; e < emailEnds.size(); e++) {
+        TokenRange email = {tokens.data() + begin, tokens.data() + emailEnds[e]};
+        singleVerdicts[e] = classifier.classify(email);
+        begin = emailEnds[e];
+    }
+    classifier.classifyBatch(tokens, emailEnds, batchVerdicts);
 
-            WordFreq wordFreq(words[i], spamFreq, hamFreq);
-            wordMap->insert(wordFreq);
+    double tokenCount = (double)tokens.size() * rounds;
+    cout << name << ": one at a time " << tokenCount / chrono::duration<double, micro>(singleEnd - singleStart).count()
+         << " M tokens/s, batched " << tokenCount / chrono::duration<double, micro>(batchEnd - batchStart).count()
+         << " M tokens/s" << (singleScores == batchScores ? "" : "  SCORES DIFFER")
+         << (singleVerdicts == batchVerdicts ? "" : "  VERDICTS DIFFER") << endl;
+    if (singleScores != batchScores || singleVerdicts != batchVerdicts) {
+        cerr << "Error: " << name << " batch results differ from one email at a time" << endl;
+        return false;
+    }
+    return true;
+}
 
-        } catch (const exception& e) {
-            cerr << "Error processing column " << i + 1 << ": " << words[i] << endl;
-            cerr << "Error message: " << e.what() << endl;
-            continue;
+// Tokenizes and classifies every email rounds times, the way the command
+// line tool does, and returns microseconds per email
+template <class Map>
+double timeEndToEnd(Map* map, const vector<string>& emails, int rounds, int& spam) {
+    BasicEmailClassifier<Map> classifier(map);
+    string buffer;
+    vector<string_view> tokens;
+    spam = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (const string& email : emails) {
+            buffer = email;
+            tokenizeInPlace(buffer, tokens);
+            spam += classifier.classify(tokens);
         }
     }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, micro>(end - start).count() / ((double)emails.size() * rounds);
+}
 
-    file.close();
+// Scores every email rounds times from its raw text, as classify does with
+// --map automaton, and returns microseconds per email. The text is copied
+// first because the maps' path lowercases it in place.
+template <class Map>
+double timeTextScoring(Map* map, const vector<string>& emails, int rounds, int& spam) {
+    BasicEmailClassifier<Map> classifier(map);
+    string buffer;
+    spam = 0;
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++) {
+        for (const string& email : emails) {
+            buffer = email;
+            spam += classifier.classifyText(&buffer[0], buffer.size());
+        }
+    }
+    auto end = chrono::steady_clock::now();
+    return chrono::duration<double, micro>(end - start).count() / ((double)emails.size() * rounds);
 }
 
+// Splits tokens into emails of emailLength tokens
+vector<size_t> makeEmailEnds(size_t tokenCount, size_t emailLength) {
+    vector<size_t> emailEnds;
+    for (size_t end = emailLength; end < tokenCount; end += emailLength) {
+        emailEnds.push_back(end);
+    }
+    emailEnds.push_back(tokenCount);
+    return emailEnds;
+}
 
 int main() {
-    
+
     ChainingHashMap chainMap(2000);
     OpenAddressingHashMap openMap(2000);
+    FlatHashMap flatMap(2000);
+    ArenaChainingHashMap arenaMap(2000);
+    PerfectHashMap perfectMap(2000);
+    PrefilteredMap<ChainingHashMap> chainBloomMap(2000);
+    PrefilteredMap<OpenAddressingHashMap> openBloomMap(2000);
+    ChainingHashMap chainMap37(2000, polynomialHash37);
+    OpenAddressingHashMap openMap37(2000, polynomialHash37);
 
-    cout << "Loading word frequencies into Chaining Hash Map..." << endl;
-    loadWordFrequenciesFromTransposedCSV("final.csv", &chainMap);
-    cout << "Loaded " << chainMap.getCount() << " words into Chaining Hash Map" << endl;
-    cout << "Load factor: " << chainMap.getLoadFactor() << endl;
-    
-    cout << "\nLoading word frequencies into Open Addressing Hash Map..." << endl;
-    loadWordFrequenciesFromTransposedCSV("final.csv", &openMap);
-    cout << "Loaded " << openMap.getCount() << " words into Open Addressing Hash Map" << endl;
-    cout << "Load factor: " << openMap.getLoadFactor() << endl;
-
-    EmailClassifier chainClassifier(&chainMap);
-    EmailClassifier openClassifier(&openMap);
-
-    vector<pair<string, vector<string>>> testEmails = {
+    vector<pair<string, HashMap*>> maps = {
+        {"Chaining", &chainMap},
+        {"Chaining (37 polynomial)", &chainMap37},
+        {"Open Addressing", &openMap},
+        {"Open Addressing (37 polynomial)", &openMap37},
+        {"Flat", &flatMap},
+        {"Arena Chaining", &arenaMap},
+        {"Perfect Hash", &perfectMap},
+        {"Chaining + Bloom", &chainBloomMap},
+        {"Open Addressing + Bloom", &openBloomMap}
+    };
+
+    for (const auto& entry : maps) {
+        cout << "Loading word frequencies into " << entry.first << " Hash Map..." << endl;
+        loadWordFrequenciesFromTransposedCSV("final.csv", entry.second);
+        cout << "Loaded " << entry.second->getCount() << " words into " << entry.first << " Hash Map" << endl;
+        printTableStats(cout, entry.first, entry.second->getStats());
+        cout << endl;
+    }
+
+    TestEmails testEmails = {
         {"spam", {"money", "free", "win", "cash"}},
         {"ham", {"meeting", "lunch", "tomorrow"}},
         {"spam", {"urgent", "money", "bank", "account"}},
         {"ham", {"project", "deadline", "report"}}
     };
 
-    cout << "\nTesting Chaining Implementation:" << endl;
-    int correctPredictions = 0;
-    for(const auto& email : testEmails) {
-        bool prediction = chainClassifier.classify(email.second);
-        bool actual = (email.first == "spam");
-        cout << "Predicted: " << (prediction ? "spam" : "ham") << ", Actual: " << email.first << endl;
-        if(prediction == actual) correctPredictions++;
+    for (const auto& entry : maps) {
+        EmailClassifier classifier(entry.second);
+        testClassifier(entry.first, classifier, testEmails);
     }
-    cout << "Accuracy: " << (double)correctPredictions/testEmails.size() * 100 << "%" << endl;
 
-    cout << "\nTesting Open Addressing Implementation:" << endl;
-    correctPredictions = 0;
-    for(const auto& email : testEmails) {
-        bool prediction = openClassifier.classify(email.second);
-        bool actual = (email.first == "spam");
-        cout << "Predicted: " << (prediction ? "spam" : "ham") << ", Actual: " << email.first << endl;
-        if(prediction == actual) correctPredictions++;
+    // Not a HashMap (its entries hold atomic counts), so it is used through
+    // the classifier template like the compiled model
+    ConcurrentHashMap concurrentMap(2000);
+    loadWordFrequenciesFromTransposedCSV("final.csv", &concurrentMap);
+    EmailClassifier concurrentClassifier(&concurrentMap);
+    testClassifier("Concurrent", concurrentClassifier, testEmails);
+    printTableStats(cout, "Concurrent", concurrentMap.getStats());
+
+    // Not a HashMap either: it finds words by walking a trie, not by hash
+    WordAutomaton automaton(2000);
+    loadWordFrequenciesFromTransposedCSV("final.csv", &automaton);
+    EmailClassifier automatonClassifier(&automaton);
+    testClassifier("Word Automaton", automatonClassifier, testEmails);
+    printTableStats(cout, "Word Automaton", automaton.getStats());
+
+    // Scores rounded to 16 or 8 bits and keys in one pool, to stay in cache
+    QuantizedModel quantizedModel(2000), quantizedModel8(2000, 8);
+    loadWordFrequenciesFromTransposedCSV("final.csv", &quantizedModel);
+    loadWordFrequenciesFromTransposedCSV("final.csv", &quantizedModel8);
+    EmailClassifier quantizedClassifier(&quantizedModel);
+    testClassifier("Quantized Model", quantizedClassifier, testEmails);
+    printTableStats(cout, "Quantized Model", quantizedModel.getStats());
+    cout << "Quantized Model: " << quantizedModel.getBytes() << " bytes, Flat: "
+         << flatMap.getStats().buckets * (sizeof(WordFreq) + 1) << " bytes of slots and control bytes" << endl;
+
+    // Words are slices of one buffer and must be looked up without being copied.
+    // The long words are past the small string limit, so a copy would allocate.
+    string emailText = "urgent money transfer to your bank account enron meeting tomorrow "
+                       "unsubscribeimmediately free cash congratulationswinner";
+    vector<string_view> emailTokens;
+    for (size_t pos = 0; pos < emailText.size(); ) {
+        size_t end = emailText.find(' ', pos);
+        if (end == string::npos) {
+            end = emailText.size();
+        }
+        if (end > pos) {
+            emailTokens.push_back(string_view(emailText).substr(pos, end - pos));
+        }
+        pos = end + 1;
+    }
+
+    bool allocationFree = true;
+    cout << "\nHeap allocations while classifying a " << emailTokens.size() << " word email:" << endl;
+    for (const auto& entry : maps) {
+        EmailClassifier classifier(entry.second);
+        size_t allocations = countClassifyAllocations(classifier, emailTokens);
+        cout << entry.first << ": " << allocations << endl;
+        if (allocations != 0) {
+            allocationFree = false;
+        }
+    }
+    size_t concurrentAllocations = countClassifyAllocations(concurrentClassifier, emailTokens);
+    cout << "Concurrent: " << concurrentAllocations << endl;
+    if (concurrentAllocations != 0) {
+        allocationFree = false;
+    }
+    size_t automatonAllocations = countClassifyAllocations(automatonClassifier, emailTokens);
+    cout << "Word Automaton: " << automatonAllocations << endl;
+    if (automatonAllocations != 0) {
+        allocationFree = false;
+    }
+    size_t quantizedAllocations = countClassifyAllocations(quantizedClassifier, emailTokens);
+    cout << "Quantized Model: " << quantizedAllocations << endl;
+    if (quantizedAllocations != 0) {
+        allocationFree = false;
+    }
+
+    // Hits are the model's own words, misses are the same words with a suffix
+    // so that key lengths stay realistic
+    vector<WordFreq> vocabulary;
+    readWordFrequenciesFromTransposedCSV("final.csv", vocabulary);
+    vector<string> hitKeys, missKeys;
+    for (const WordFreq& wf : vocabulary) {
+        hitKeys.push_back(wf.word);
+        missKeys.push_back(wf.word + "zq");
+    }
+
+    // Tokenizer: normalisation, then throughput on a multi-megabyte message
+    // against the old stringstream >> word split
+    {
+        string sample = "FREE!!! Click NOW to win $1000 -- Enron/HPL meeting re: gas deal.";
+        vector<string_view> sampleTokens;
+        tokenizeInPlace(sample, sampleTokens);
+        cout << "\nTokens:";
+        for (string_view token : sampleTokens) {
+            cout << " [" << token << "]";
+        }
+        cout << endl;
+
+        string bigEmail;
+        const char* separators[] = {" ", ", ", ". ", "!\n", " -- ", "? "};
+        for (size_t i = 0; bigEmail.size() < 8 * 1024 * 1024; i++) {
+            string word = hitKeys[(i * 7) % hitKeys.size()];
+            if (i % 3 == 0) {
+                word[0] = (char)toupper(word[0]);
+            }
+            bigEmail += word;
+            bigEmail += separators[i % 6];
+        }
+
+        string buffer = bigEmail;
+        vector<string_view> bigTokens;
+        auto tokenizeStart = chrono::steady_clock::now();
+        tokenizeInPlace(buffer, bigTokens);
+        auto tokenizeEnd = chrono::steady_clock::now();
+
+        vector<string> streamWords;
+        auto streamStart = chrono::steady_clock::now();
+        stringstream ss(bigEmail);
+        string word;
+        while (ss >> word) {
+            streamWords.push_back(word);
+        }
+        auto streamEnd = chrono::steady_clock::now();
+
+        double megabytes = bigEmail.size() / (1024.0 * 1024.0);
+        cout << "Tokenizer: " << megabytes / chrono::duration<double>(tokenizeEnd - tokenizeStart).count() << " MB/s ("
+             << bigTokens.size() << " tokens), stringstream: "
+             << megabytes / chrono::duration<double>(streamEnd - streamStart).count() << " MB/s ("
+             << streamWords.size() << " words)" << endl;
+    }
+
+    cout << "\nHash distribution over " << hitKeys.size() << " words:" << endl;
+    for (int tableSize : {2048, 4096}) {
+        printHashDistribution("wordHash64", wordHash64, hitKeys, tableSize);
+        printHashDistribution("polynomialHash37", polynomialHash37, hitKeys, tableSize);
+    }
+
+    const int rounds = 200;
+    cout << "\nLookup timing (" << rounds << " rounds over " << hitKeys.size() << " keys):" << endl;
+    for (const auto& entry : maps) {
+        int hits, misses;
+        double hitNs = timeLookups(entry.second, hitKeys, rounds, hits);
+        double missNs = timeLookups(entry.second, missKeys, rounds, misses);
+        cout << entry.first << ": hit " << hitNs << " ns/op, miss " << missNs << " ns/op"
+             << " (found " << hits << " / " << misses << ")" << endl;
+    }
+    {
+        int hits, misses;
+        double hitNs = timeLookups(&concurrentMap, hitKeys, rounds, hits);
+        double missNs = timeLookups(&concurrentMap, missKeys, rounds, misses);
+        cout << "Concurrent: hit " << hitNs << " ns/op, miss " << missNs << " ns/op"
+             << " (found " << hits << " / " << misses << ")" << endl;
+    }
+    {
+        int hits, misses;
+        double hitNs = timeLookups(&automaton, hitKeys, rounds, hits);
+        double missNs = timeLookups(&automaton, missKeys, rounds, misses);
+        cout << "Word Automaton: hit " << hitNs << " ns/op, miss " << missNs << " ns/op"
+             << " (found " << hits << " / " << misses << ")" << endl;
+    }
+    {
+        int hits, misses;
+        double hitNs = timeLookups(&quantizedModel, hitKeys, rounds, hits);
+        double missNs = timeLookups(&quantizedModel, missKeys, rounds, misses);
+        cout << "Quantized Model: hit " << hitNs << " ns/op, miss " << missNs << " ns/op"
+             << " (found " << hits << " / " << misses << ")" << endl;
+    }
+
+    // Ordinary email text, for the Bloom filter and the word automaton
+    const char* sampleEmails[] = {
+        "Subject: re: nomination for march\nDaren, we agree with the volumes on the meter for the first week. "
+        "Could you please confirm the price and send me the deal ticket before the meeting tomorrow? "
+        "Let me know if you have any questions. Thanks, Bob",
+        "Subject: enron / hpl actuals for april 5\nTeco Tap 40.000 / Enron; 15.000 / HPL Gas Daily. "
+        "LS HPL LSK IC 20.000 / Enron. The schedule was changed after the pipeline called this morning, "
+        "so the flow at the plant is lower than what was nominated.",
+        "Subject: your account has been suspended\nDear customer, we were unable to verify your information. "
+        "Click here now to restore access to your account and claim your free bonus. This offer expires "
+        "in 24 hours, act now! Unsubscribe from our mailing list at any time.",
+        "Subject: cheap meds online\nBest prices on all medications, no prescription needed! Save up to 80% "
+        "and get fast worldwide shipping. Visit our online pharmacy today and see why thousands of happy "
+        "customers trust us. Limited time offer.",
+        "Subject: lunch on friday\nHi all, I booked a table for twelve at the usual place. Please reply by "
+        "Thursday so I can tell them how many people are coming. The office will close early because of "
+        "the holiday, so plan your travel accordingly.",
+        "Subject: make money fast\nEarn $5000 a week from home with this simple system! No experience "
+        "required. Thousands of people are already making money. Order now and receive a free report "
+        "with the secrets the banks do not want you to know."
+    };
+    vector<string> realEmails;
+    for (int copy = 0; copy < 50; copy++) {
+        for (const char* email : sampleEmails) {
+            realEmails.push_back(email);
+        }
+    }
+
+    // Most words of a real email are not in the model, so the Bloom filter
+    // is measured on ordinary email text as well as on the synthetic misses
+    {
+        cout << "\nBloom prefilter (" << chainBloomMap.getFilter().getBytes() << " bytes for "
+             << chainBloomMap.getCount() << " words):" << endl;
+        vector<string> absentKeys = missKeys;
+        for (int i = 0; i < 200000; i++) {
+            absentKeys.push_back("absent" + to_string(i));
+        }
+        cout << "False positive rate over " << absentKeys.size() << " absent words: "
+             << chainBloomMap.measureFalsePositiveRate(absentKeys) * 100 << "% (Chaining), "
+             << openBloomMap.measureFalsePositiveRate(absentKeys) * 100 << "% (Open Addressing)" << endl;
+
+        size_t realTokens = 0, realHits = 0;
+        for (const char* email : sampleEmails) {
+            string buffer = email;
+            vector<string_view> tokens;
+            tokenizeInPlace(buffer, tokens);
+            for (string_view token : tokens) {
+                realTokens++;
+                realHits += chainMap.search(token) != nullptr;
+            }
+        }
+        cout << "Sample emails: " << realTokens << " tokens, " << realHits * 100 / realTokens
+             << "% in the model" << endl;
+
+        int plainSpam, filteredSpam;
+        double chainUs = timeEndToEnd(&chainMap, realEmails, 200, plainSpam);
+        double chainBloomUs = timeEndToEnd(&chainBloomMap, realEmails, 200, filteredSpam);
+        cout << "Chaining: " << chainUs << " us/email, with Bloom " << chainBloomUs << " us/email, speedup "
+             << chainUs / chainBloomUs << "x" << (plainSpam == filteredSpam ? "" : "  VERDICTS DIFFER") << endl;
+        if (plainSpam != filteredSpam) {
+            cerr << "Error: the Bloom prefilter changed Chaining verdicts" << endl;
+            return 1;
+        }
+        double openUs = timeEndToEnd(&openMap, realEmails, 200, plainSpam);
+        double openBloomUs = timeEndToEnd(&openBloomMap, realEmails, 200, filteredSpam);
+        cout << "Open Addressing: " << openUs << " us/email, with Bloom " << openBloomUs << " us/email, speedup "
+             << openUs / openBloomUs << "x" << (plainSpam == filteredSpam ? "" : "  VERDICTS DIFFER") << endl;
+        if (plainSpam != filteredSpam) {
+            cerr << "Error: the Bloom prefilter changed Open Addressing verdicts" << endl;
+            return 1;
+        }
+    }
+
+    // The automaton must find exactly the words tokenize + search finds, so
+    // every score matches to the last bit. Text is also timed in bulk: the
+    // sample emails, with odd casing, punctuation and UTF-8, repeated to 8 MB.
+    {
+        cout << "\nWord automaton (" << automaton.getBytes() << " bytes for " << automaton.getCount() << " words):" << endl;
+        bool lookupsMatch = true;
+        for (size_t i = 0; i < hitKeys.size(); i++) {
+            WordFreq* found = automaton.search(hitKeys[i]);
+            lookupsMatch = lookupsMatch && found && found->spamFreq == chainMap.search(hitKeys[i])->spamFreq
+                && !automaton.search(missKeys[i]);
+        }
+        cout << "Lookups of " << hitKeys.size() << " hits and misses" << (lookupsMatch ? " match Chaining" : "  LOOKUPS DIFFER") << endl;
+        if (!lookupsMatch) {
+            cerr << "Error: word automaton lookups differ from Chaining" << endl;
+            return 1;
+        }
+
+        BasicEmailClassifier<WordAutomaton> automatonScorer(&automaton);
+        BasicEmailClassifier<FlatHashMap> flatScorer(&flatMap);
+        vector<string> scoreTexts = realEmails;
+        scoreTexts.push_back("");
+        scoreTexts.push_back("   ,,, !!");
+        scoreTexts.push_back("MONEY money MoNeY money. Money--money\tmoney\r\nmoney");
+        scoreTexts.push_back("caf\xc3\xa9 na\xc3\xafve \xe2\x82\xac" "100 free free2 free_cash 2free");
+        scoreTexts.push_back(hitKeys.back());
+        string bulkText;
+        for (size_t i = 0; bulkText.size() < 8 * 1024 * 1024; i++) {
+            bulkText += scoreTexts[i % scoreTexts.size()];
+            bulkText += i % 2 ? "\n" : " ";
+        }
+        size_t scoreMismatches = 0;
+        for (const string& text : scoreTexts) {
+            string automatonBuffer = text, flatBuffer = text;
+            double automatonScore = automatonScorer.scoreText(&automatonBuffer[0], automatonBuffer.size());
+            double flatScore = flatScorer.scoreText(&flatBuffer[0], flatBuffer.size());
+            scoreMismatches += automatonScore != flatScore || automatonBuffer != text;
+        }
+        cout << "Scores of " << scoreTexts.size() << " texts" << (scoreMismatches == 0 ? " match tokenize + search" : "  SCORES DIFFER") << endl;
+        if (scoreMismatches != 0) {
+            cerr << "Error: word automaton scores differ from tokenize + search" << endl;
+            return 1;
+        }
+
+        string automatonBuffer = bulkText, flatBuffer = bulkText, chainBuffer = bulkText;
+        BasicEmailClassifier<ChainingHashMap> chainScorer(&chainMap);
+        auto automatonStart = chrono::steady_clock::now();
+        double automatonScore = automatonScorer.scoreText(&automatonBuffer[0], automatonBuffer.size());
+        auto flatStart = chrono::steady_clock::now();
+        double flatScore = flatScorer.scoreText(&flatBuffer[0], flatBuffer.size());
+        auto chainStart = chrono::steady_clock::now();
+        double chainScore = chainScorer.scoreText(&chainBuffer[0], chainBuffer.size());
+        auto chainEnd = chrono::steady_clock::now();
+        double megabytes = bulkText.size() / (1024.0 * 1024.0);
+        cout << "Scoring " << megabytes << " MB of text: automaton "
+             << megabytes / chrono::duration<double>(flatStart - automatonStart).count() << " MB/s, tokenize + Flat "
+             << megabytes / chrono::duration<double>(chainStart - flatStart).count() << " MB/s, tokenize + Chaining "
+             << megabytes / chrono::duration<double>(chainEnd - chainStart).count() << " MB/s"
+             << (automatonScore == flatScore && flatScore == chainScore ? "" : "  SCORES DIFFER") << endl;
+        if (automatonScore != flatScore || flatScore != chainScore) {
+            cerr << "Error: bulk text scores differ between the automaton, Flat and Chaining" << endl;
+            return 1;
+        }
+
+        int automatonSpam, flatSpam;
+        double automatonUs = timeTextScoring(&automaton, realEmails, 200, automatonSpam);
+        double flatUs = timeTextScoring(&flatMap, realEmails, 200, flatSpam);
+        cout << "Sample emails: automaton " << automatonUs << " us/email, tokenize + Flat " << flatUs
+             << " us/email, speedup " << flatUs / automatonUs << "x"
+             << (automatonSpam == flatSpam ? "" : "  VERDICTS DIFFER") << endl;
+        if (automatonSpam != flatSpam) {
+            cerr << "Error: word automaton verdicts differ from Flat" << endl;
+            return 1;
+        }
+    }
+
+    // A long email made of model words with a miss after every hit
+    vector<string_view> streamTokens;
+    for (int i = 0; i < 50; i++) {
+        for (size_t w = 0; w < hitKeys.size(); w++) {
+            streamTokens.push_back(hitKeys[w]);
+            streamTokens.push_back(missKeys[(w + i) % missKeys.size()]);
+        }
+    }
+
+    cout << "\nClassify throughput, virtual vs static dispatch (" << streamTokens.size() << " tokens):" << endl;
+    compareDispatch("Chaining", &chainMap, streamTokens, 20);
+    compareDispatch("Open Addressing", &openMap, streamTokens, 20);
+    compareDispatch("Flat", &flatMap, streamTokens, 20);
+    compareDispatch("Arena Chaining", &arenaMap, streamTokens, 20);
+    compareDispatch("Perfect Hash", &perfectMap, streamTokens, 20);
+
+    vector<size_t> streamEmailEnds = makeEmailEnds(streamTokens.size(), 100);
+    cout << "\nBatch classification of " << streamEmailEnds.size() << " emails, final.csv model:" << endl;
+    if (!compareBatch("Chaining", &chainMap, streamTokens, streamEmailEnds, 20)) {
+        return 1;
+    }
+    if (!compareBatch("Open Addressing", &openMap, streamTokens, streamEmailEnds, 20)) {
+        return 1;
+    }
+    if (!compareBatch("Flat", &flatMap, streamTokens, streamEmailEnds, 20)) {
+        return 1;
+    }
+    if (!compareBatch("Arena Chaining", &arenaMap, streamTokens, streamEmailEnds, 20)) {
+        return 1;
+    }
+    if (!compareBatch("Perfect Hash", &perfectMap, streamTokens, streamEmailEnds, 20)) {
+        return 1;
+    }
+
+    // Stats are meant to stay on, so their cost per email has to be small
+    {
+        BasicEmailClassifier<ChainingHashMap> classifier(&chainMap);
+        ClassifierStats stats;
+        double nanosOff = 0, nanosOn = 0;
+        for (int pass = 0; pass < 2; pass++) {
+            classifier.setStats(pass ? &stats : nullptr);
+            auto start = chrono::steady_clock::now();
+            for (int r = 0; r < 20; r++) {
+                size_t begin = 0;
+                for (size_t end : streamEmailEnds) {
+                    TokenRange email = {streamTokens.data() + begin, streamTokens.data() + end};
+                    classifier.classify(email);
+                    begin = end;
+                }
+            }
+            auto end = chrono::steady_clock::now();
+            (pass ? nanosOn : nanosOff) = chrono::duration<double, nano>(end - start).count() / (20.0 * streamEmailEnds.size());
+        }
+        vector<bool> batchVerdicts;
+        classifier.classifyBatch(streamTokens, streamEmailEnds, batchVerdicts);
+
+        cout << "\nClassifier stats, Chaining map:" << endl;
+        stats.print(cout, "Chaining");
+        cout << "Cost per email: " << nanosOff << " ns without stats, " << nanosOn << " ns with stats" << endl;
+        ClassifierSummary summary = stats.summary();
+        // classify() may stop early; the batch always reads every token
+        if (summary.emails != 21 * streamEmailEnds.size() || summary.tokens > 21 * streamTokens.size() ||
+            summary.tokens < streamTokens.size() || summary.hits > summary.tokens) {
+            cerr << "Error: classifier stats do not match what was classified" << endl;
+            return 1;
+        }
+
+        // classify() stops once the rest of the email cannot change the
+        // verdict; score() always reads all of it
+        vector<size_t> longEmailEnds = makeEmailEnds(streamTokens.size(), 1000);
+        classifier.setStats(nullptr);
+        vector<bool> earlyVerdicts, fullVerdicts;
+        auto earlyStart = chrono::steady_clock::now();
+        for (int r = 0; r < 20; r++) {
+            earlyVerdicts.clear();
+            size_t begin = 0;
+            for (size_t end : longEmailEnds) {
+                TokenRange email = {streamTokens.data() + begin, streamTokens.data() + end};
+                earlyVerdicts.push_back(classifier.classify(email));
+                begin = end;
+            }
+        }
+        auto earlyEnd = chrono::steady_clock::now();
+        auto fullStart = chrono::steady_clock::now();
+        for (int r = 0; r < 20; r++) {
+            fullVerdicts.clear();
+            size_t begin = 0;
+            for (size_t end : longEmailEnds) {
+                TokenRange email = {streamTokens.data() + begin, streamTokens.data() + end};
+                double score = classifier.score(email);
+                fullVerdicts.push_back(score >= 0 && score >= classifier.getThreshold());
+                begin = end;
+            }
+        }
+        auto fullEnd = chrono::steady_clock::now();
+        cout << "1000-token emails: early exit " << chrono::duration<double, micro>(earlyEnd - earlyStart).count() / (20.0 * longEmailEnds.size())
+             << " us/email, full scan " << chrono::duration<double, micro>(fullEnd - fullStart).count() / (20.0 * longEmailEnds.size())
+             << " us/email" << endl;
+        if (earlyVerdicts != fullVerdicts) {
+            cerr << "Error: early exit changed a verdict" << endl;
+            return 1;
+        }
+
+        // Stats taken part way through an incremental resize still see every word
+        ChainingHashMap growing(16);
+        for (size_t i = 0; i < 40; i++) {
+            growing.insert(WordFreq(hitKeys[i], 1, 1));
+        }
+        TableStats growingStats = growing.getStats();
+        if (growingStats.words != (size_t)growing.getCount()) {
+            cerr << "Error: table stats lost words during a resize" << endl;
+            return 1;
+        }
+    }
+
+    // Prefetching matters once the model no longer fits in cache. The perfect
+    // hash only pays off if building it stays close to filling the other maps.
+    {
+        const int bigVocabulary = 300000;
+        vector<string> bigWords, bigMissKeys;
+        for (int i = 0; i < bigVocabulary; i++) {
+            bigWords.push_back("word" + to_string(i));
+            bigMissKeys.push_back(bigWords[i] + "zq");
+        }
+        ChainingHashMap bigChainMap(1024);
+        OpenAddressingHashMap bigOpenMap(1024);
+        FlatHashMap bigFlatMap(1024);
+        PerfectHashMap bigPerfectMap(1024);
+        vector<pair<string, HashMap*>> bigMaps = {
+            {"Chaining", &bigChainMap},
+            {"Open Addressing", &bigOpenMap},
+            {"Flat", &bigFlatMap},
+            {"Perfect Hash", &bigPerfectMap}
+        };
+        cout << "\nBuilding a " << bigVocabulary << " word model:" << endl;
+        for (const auto& entry : bigMaps) {
+            auto buildStart = chrono::steady_clock::now();
+            for (int i = 0; i < bigVocabulary; i++) {
+                entry.second->insert(WordFreq(bigWords[i], i % 7, i % 5));
+            }
+            entry.second->finishRehash();
+            auto buildEnd = chrono::steady_clock::now();
+            cout << entry.first << ": " << chrono::duration<double, nano>(buildEnd - buildStart).count() / bigVocabulary
+                 << " ns/word" << endl;
+        }
+        cout << "Perfect Hash index: " << bigPerfectMap.getIndexBitsPerKey() << " bits/word" << endl;
+
+        vector<string_view> bigTokens;
+        unsigned random = 12345;
+        for (int i = 0; i < 200000; i++) {
+            random = random * 1103515245u + 12345u;
+            bigTokens.push_back(bigWords[(random >> 8) % bigVocabulary]);
+        }
+        vector<size_t> bigEmailEnds = makeEmailEnds(bigTokens.size(), 100);
+
+        cout << "\nBatch classification of " << bigEmailEnds.size() << " emails, " << bigVocabulary << " word model:" << endl;
+        if (!compareBatch("Chaining", &bigChainMap, bigTokens, bigEmailEnds, 5) ||
+            !compareBatch("Open Addressing", &bigOpenMap, bigTokens, bigEmailEnds, 5) ||
+            !compareBatch("Flat", &bigFlatMap, bigTokens, bigEmailEnds, 5) ||
+            !compareBatch("Perfect Hash", &bigPerfectMap, bigTokens, bigEmailEnds, 5)) {
+            return 1;
+        }
+
+        // The same model in 8-byte entries; its scores must round to the
+        // nearest 16-bit step of the full ones
+        QuantizedModel bigQuantizedModel(1024);
+        for (int i = 0; i < bigVocabulary; i++) {
+            bigQuantizedModel.insert(WordFreq(bigWords[i], i % 7, i % 5));
+        }
+        cout << "Quantized Model: " << bigQuantizedModel.getBytes() / 1024 << " KB, Flat: "
+             << bigFlatMap.getStats().buckets * (sizeof(WordFreq) + 1) / 1024 << " KB" << endl;
+        if (!compareBatch("Quantized Model", &bigQuantizedModel, bigTokens, bigEmailEnds, 5)) {
+            return 1;
+        }
+        for (int i = 0; i < bigVocabulary; i++) {
+            const QuantizedEntry* entry = bigQuantizedModel.search(bigWords[i]);
+            float fullScore = wordSpamScore(i % 7, i % 5);
+            if (!entry || fabs(entry->getSpamScore() - fullScore) > 0.5f / QUANTIZED_SCORE_SCALE + 1e-6f ||
+                (fullScore < 0) != (entry->getSpamScore() < 0) || bigQuantizedModel.search(bigMissKeys[i])) {
+                cerr << "Error: quantized lookup of " << bigWords[i] << " is wrong" << endl;
+                return 1;
+            }
+        }
+
+        for (int i = 0; i < bigVocabulary; i++) {
+            WordFreq* wf = bigPerfectMap.search(bigWords[i]);
+            if (!wf || wf->spamFreq != i % 7 || wf->hamFreq != i % 5 || bigPerfectMap.search(bigMissKeys[i])) {
+                cerr << "Error: perfect hash lookup of " << bigWords[i] << " is wrong" << endl;
+                return 1;
+            }
+        }
+        // Known words are updated in place; a new word is staged until
+        // finishRehash folds it into the index
+        bigPerfectMap.insert(WordFreq(bigWords[0], 40, 2));
+        bigPerfectMap.insert(WordFreq("zzunseen", 3, 1));
+        for (int pass = 0; pass < 2; pass++) {
+            WordFreq* updated = bigPerfectMap.search(bigWords[0]);
+            WordFreq* added = bigPerfectMap.search("zzunseen");
+            if (!updated || updated->spamFreq != 40 || !added || added->hamFreq != 1 ||
+                bigPerfectMap.getCount() != bigVocabulary + 1 || !bigPerfectMap.search(bigWords[bigVocabulary - 1]) ||
+                bigPerfectMap.search(bigMissKeys[0])) {
+                cerr << "Error: perfect hash lost an update" << (pass == 0 ? " while it was staged" : "") << endl;
+                return 1;
+            }
+            bigPerfectMap.finishRehash();
+        }
+    }
+
+    // Thread counts for the scaling runs: powers of two up to the hardware
+    int maxThreads = max(1, (int)thread::hardware_concurrency());
+    vector<int> threadCounts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        threadCounts.push_back(threads);
+    }
+    threadCounts.push_back(maxThreads);
+
+    // Corpus scoring across threads, checked against a serial run
+    {
+        vector<EmailData> corpus;
+        unsigned random = 777;
+        for (int e = 0; e < 4000; e++) {
+            EmailData email;
+            email.first = e % 2 ? "spam" : "ham";
+            for (int w = 0; w < 150; w++) {
+                random = random * 1103515245u + 12345u;
+                size_t pick = (random >> 8) % (hitKeys.size() * 2);
+                email.second.push_back(pick < hitKeys.size() ? hitKeys[pick] : missKeys[pick - hitKeys.size()]);
+            }
+            corpus.push_back(email);
+        }
+
+        BasicEmailClassifier<FlatHashMap> serialClassifier(&flatMap);
+        vector<char> serialVerdicts;
+        for (const EmailData& email : corpus) {
+            serialVerdicts.push_back(serialClassifier.classify(email.second));
+        }
+
+        cout << "\nParallel scoring of " << corpus.size() << " emails (Flat map, "
+             << maxThreads << " hardware threads):" << endl;
+        double oneThreadRate = 0;
+        for (int threads : threadCounts) {
+            WorkStealingPool pool(threads);
+            ParallelScorer<FlatHashMap> scorer(&flatMap, pool);
+            vector<char> verdicts;
+            const int rounds = 10;
+            auto start = chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++) {
+                scorer.score(corpus, verdicts);
+            }
+            auto end = chrono::steady_clock::now();
+            double emailsPerSecond = corpus.size() * rounds / chrono::duration<double>(end - start).count();
+            if (threads == 1) {
+                oneThreadRate = emailsPerSecond;
+            }
+            cout << threads << " thread(s): " << emailsPerSecond << " emails/s, speedup "
+                 << emailsPerSecond / oneThreadRate << "x" << (verdicts == serialVerdicts ? "" : "  VERDICTS DIFFER") << endl;
+            if (verdicts != serialVerdicts) {
+                cerr << "Error: parallel verdicts differ with " << threads << " thread(s)" << endl;
+                return 1;
+            }
+        }
+    }
+
+    // Concurrent map: readers keep looking words up while a writer adds
+    // feedback counts to existing words and inserts new ones
+    {
+        cout << "\nConcurrent map lookups with a writer running:" << endl;
+        for (int threads : threadCounts) {
+            ConcurrentHashMap liveMap(2000);
+            loadWordFrequenciesFromTransposedCSV("final.csv", &liveMap);
+
+            atomic<bool> writing(true);
+            atomic<long> lookups(0);
+            vector<thread> readers;
+            for (int t = 0; t < threads; t++) {
+                readers.push_back(thread([&]() {
+                    long done = 0;
+                    while (writing) {
+                        for (size_t k = 0; k < hitKeys.size(); k++) {
+                            done += liveMap.search(hitKeys[k]) != nullptr;
+                            done += liveMap.search(missKeys[k]) == nullptr ? 1 : 0;
+                        }
+                    }
+                    lookups += done;
+                }));
+            }
+
+            auto start = chrono::steady_clock::now();
+            const int updateRounds = 20;
+            for (int r = 0; r < updateRounds; r++) {
+                for (size_t k = 0; k < hitKeys.size(); k++) {
+                    liveMap.addCounts(hitKeys[k], 1, 0);
+                }
+            }
+            for (size_t k = 0; k < missKeys.size(); k++) {
+                liveMap.addCounts(missKeys[k] + "new", 0, 1);
+            }
+            this_thread::sleep_for(chrono::milliseconds(50));
+            writing = false;
+            for (thread& reader : readers) {
+                reader.join();
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+            bool countsOk = liveMap.getCount() == (int)(hitKeys.size() + missKeys.size());
+            for (const WordFreq& wf : vocabulary) {
+                ConcurrentWordFreq* entry = liveMap.search(wf.word);
+                WordFreq* original = chainMap.search(wf.word);
+                if (!entry || entry->spamFreq != original->spamFreq + updateRounds) {
+                    countsOk = false;
+                }
+            }
+            cout << threads << " reader(s): " << lookups / seconds / 1e6 << " M lookups/s"
+                 << (countsOk ? "" : "  COUNTS DIFFER") << endl;
+            if (!countsOk) {
+                cerr << "Error: concurrent map counts are wrong with " << threads << " reader(s)" << endl;
+                return 1;
+            }
+        }
+    }
+
+    // Per-email dataset parsing: a synthetic export shaped like the training
+    // data (one column per word, mostly zero counts, label last)
+    {
+        const string datasetFile = "synthetic_dataset.csv";
+        const int columns = 3000, rows = 2000;
+        {
+            ofstream out(datasetFile);
+            out << "Email No.";
+            for (int c = 0; c < columns; c++) {
+                out << ',' << hitKeys[c % hitKeys.size()];
+            }
+            out << ",Prediction\n";
+            unsigned random = 4242;
+            for (int r = 0; r < rows; r++) {
+                out << "Email " << r + 1;
+                for (int c = 0; c < columns; c++) {
+                    random = random * 1103515245u + 12345u;
+                    unsigned roll = (random >> 8) % 100;
+                    out << ',' << (roll < 95 ? 0 : roll - 94);
+                }
+                out << ',' << r % 2 << "\r\n";
+            }
+        }
+
+        vector<string> datasetHeader = readHeader(datasetFile);
+        datasetHeader.pop_back();       //"Prediction" is the label column
+
+        vector<EmailData> streamSpam, streamHam, fastSpam, fastHam;
+        auto streamStart = chrono::steady_clock::now();
+        readEntireDatasetStream(datasetFile, datasetHeader, streamSpam, streamHam);
+        auto streamEnd = chrono::steady_clock::now();
+        readEntireDataset(datasetFile, datasetHeader, fastSpam, fastHam);
+        auto fastEnd = chrono::steady_clock::now();
+
+        double streamSeconds = chrono::duration<double>(streamEnd - streamStart).count();
+        double fastSeconds = chrono::duration<double>(fastEnd - streamEnd).count();
+        double megabytes = (double)rows * columns * 2 / 1e6;
+        cout << "\nDataset parsing (" << rows << " emails x " << columns << " words, about "
+             << megabytes << " MB):" << endl;
+        cout << "getline + stoi: " << streamSeconds * 1000 << " ms" << endl;
+        cout << "Mapped SIMD parser: " << fastSeconds * 1000 << " ms, speedup " << streamSeconds / fastSeconds << "x"
+             << (fastSpam == streamSpam && fastHam == streamHam ? "" : "  RESULTS DIFFER") << endl;
+        if (fastSpam != streamSpam || fastHam != streamHam) {
+            cerr << "Error: the mapped parser disagrees with getline + stoi" << endl;
+            return 1;
+        }
+
+        // The same file as (wordId, count) pairs
+        SparseCorpus sparse;
+        auto sparseStart = chrono::steady_clock::now();
+        readSparseDataset(datasetFile, datasetHeader, sparse);
+        auto sparseEnd = chrono::steady_clock::now();
+
+        size_t denseBytes = (fastSpam.capacity() + fastHam.capacity()) * sizeof(EmailData);
+        for (const vector<EmailData>* emails : {&fastSpam, &fastHam}) {
+            for (const EmailData& email : *emails) {
+                denseBytes += email.second.capacity() * sizeof(string);
+                for (const string& word : email.second) {
+                    if (word.capacity() > string().capacity()) {
+                        denseBytes += word.capacity() + 1;
+                    }
+                }
+            }
+        }
+        cout << "Sparse parser: " << chrono::duration<double, milli>(sparseEnd - sparseStart).count() << " ms" << endl;
+        cout << "Memory: " << denseBytes / 1024 << " KB as repeated words, " << sparse.memoryUsage() / 1024
+             << " KB as word counts (" << sparse.counts.size() << " pairs, "
+             << sparse.vocabulary.size() << " distinct words)" << endl;
+
+        // Weighted scoring must agree with scoring the repeated words
+        BasicEmailClassifier<FlatHashMap> datasetClassifier(&flatMap, 0.5);
+        size_t spamIndex = 0, hamIndex = 0, disagreements = 0;
+        for (size_t i = 0; i < sparse.size(); i++) {
+            const EmailData& email = sparse.labels[i] ? fastSpam[spamIndex++] : fastHam[hamIndex++];
+            if (datasetClassifier.classify(sparse, i) != datasetClassifier.classify(email.second)) {
+                disagreements++;
+            }
+        }
+        auto denseStart = chrono::steady_clock::now();
+        size_t denseSpam = 0;
+        for (const vector<EmailData>* emails : {&fastSpam, &fastHam}) {
+            for (const EmailData& email : *emails) {
+                denseSpam += datasetClassifier.classify(email.second);
+            }
+        }
+        auto denseEnd = chrono::steady_clock::now();
+        size_t sparseSpam = 0;
+        for (size_t i = 0; i < sparse.size(); i++) {
+            sparseSpam += datasetClassifier.classify(sparse, i);
+        }
+        auto sparseScoreEnd = chrono::steady_clock::now();
+        cout << "Scoring " << sparse.size() << " emails: " << chrono::duration<double, milli>(denseEnd - denseStart).count()
+             << " ms repeated words, " << chrono::duration<double, milli>(sparseScoreEnd - denseEnd).count()
+             << " ms weighted counts" << (disagreements == 0 && denseSpam == sparseSpam ? "" : "  VERDICTS DIFFER") << endl;
+        if (disagreements != 0 || denseSpam != sparseSpam) {
+            cerr << "Error: sparse corpus verdicts differ from the dense dataset" << endl;
+            return 1;
+        }
+
+        // What rounding the scores costs. An email's average moves by no more
+        // than half a quantization step, plus float rounding.
+        vector<double> fullScores, scores16, scores8;
+        AccuracyReport full = measureAccuracy(&flatMap, sparse, 0.5, fullScores);
+        AccuracyReport quantized16 = measureAccuracy(&quantizedModel, sparse, 0.5, scores16, &fullScores);
+        AccuracyReport quantized8 = measureAccuracy(&quantizedModel8, sparse, 0.5, scores8, &fullScores);
+        cout << "Quantized scores on " << sparse.size() << " labelled emails:" << endl;
+        printAccuracyReport(cout, "Full precision", full);
+        printAccuracyReport(cout, "16-bit", quantized16, &full);
+        printAccuracyReport(cout, "8-bit", quantized8, &full);
+        if (quantized16.maxScoreDelta > 0.5 / 65280 + 1e-6 || quantized8.maxScoreDelta > 0.5 / 255 + 1e-6) {
+            cout << "  SCORES DIFFER by more than the quantization step" << endl;
+            cerr << "Error: quantized scores moved by more than half a step" << endl;
+            return 1;
+        }
+
+        // Training from the dataset, checked against totals from the sparse corpus
+        vector<double> expectedSpam(sparse.vocabulary.size(), 0.0), expectedHam(sparse.vocabulary.size(), 0.0);
+        for (size_t i = 0; i < sparse.size(); i++) {
+            vector<double>& totals = sparse.labels[i] ? expectedSpam : expectedHam;
+            for (const WordCount* wc = sparse.begin(i); wc != sparse.end(i); ++wc) {
+                totals[wc->wordId] += wc->count;
+            }
+        }
+        auto trainingMatches = [&](const vector<WordFreq>& model) {
+            if (model.size() != sparse.vocabulary.size()) {
+                return false;
+            }
+            for (size_t w = 0; w < model.size(); w++) {
+                if (model[w].word != sparse.vocabulary[w] || model[w].spamFreq != expectedSpam[w] ||
+                    model[w].hamFreq != expectedHam[w]) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        cout << "Training from the dataset:" << endl;
+        vector<WordFreq> trained;
+        for (int threads : threadCounts) {
+            auto trainStart = chrono::steady_clock::now();
+            trainWordFrequencies(datasetFile, datasetHeader, trained, threads);
+            auto trainEnd = chrono::steady_clock::now();
+            bool frequenciesMatch = trainingMatches(trained);
+            cout << threads << " thread(s): " << chrono::duration<double, milli>(trainEnd - trainStart).count()
+                 << " ms" << (frequenciesMatch ? "" : "  FREQUENCIES DIFFER") << endl;
+            if (!frequenciesMatch) {
+                cerr << "Error: training with " << threads << " thread(s) gave the wrong frequencies" << endl;
+                return 1;
+            }
+        }
+
+        // Round trip through the transposed CSV the maps load from
+        const string trainedFile = "synthetic_trained.csv";
+        vector<WordFreq> reloaded;
+        bool roundTrip = writeWordFrequenciesToTransposedCSV(trainedFile, trained) &&
+                         readWordFrequenciesFromTransposedCSV(trainedFile, reloaded) && trainingMatches(reloaded);
+        remove(trainedFile.c_str());
+        cout << "Trained model CSV round trip: " << (roundTrip ? "ok" : "FAILED") << endl;
+        remove(datasetFile.c_str());
+        if (!roundTrip) {
+            cerr << "Error: the trained model did not survive the transposed CSV round trip" << endl;
+            return 1;
+        }
+    }
+
+    // Feedback log: replaying must give the same totals before and after
+    // compaction and after a torn record is cut off
+    {
+        const string logFile = "synthetic_feedback.log";
+        remove(logFile.c_str());
+        FeedbackLog log;
+        log.open(logFile);
+
+        unordered_map<string, pair<double, double>> expected;
+        unsigned random = 99;
+        for (int e = 0; e < 500; e++) {
+            vector<string_view> words;
+            for (int w = 0; w < 40; w++) {
+                random = random * 1103515245u + 12345u;
+                size_t pick = (random >> 8) % (hitKeys.size() * 2);
+                words.push_back(pick < hitKeys.size() ? hitKeys[pick] : missKeys[pick - hitKeys.size()]);
+            }
+            vector<FeedbackWord> feedback = countFeedbackWords(words, e % 3 == 0);
+            for (const FeedbackWord& fw : feedback) {
+                expected[fw.word].first += fw.spamCount;
+                expected[fw.word].second += fw.hamCount;
+            }
+            log.append(feedback);
+        }
+
+        auto replayMatches = [&](FeedbackLog& replayed, double& micros) {
+            ChainingHashMap feedbackMap(2000);
+            auto start = chrono::steady_clock::now();
+            replayed.replay([&](string_view word, uint32_t spamCount, uint32_t hamCount) {
+                FeedbackWord fw = {string(word), spamCount, hamCount};
+                applyFeedback(&feedbackMap, fw);
+            });
+            micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+            if (feedbackMap.getCount() != (int)expected.size()) {
+                return false;
+            }
+            for (const auto& entry : expected) {
+                WordFreq* wf = feedbackMap.search(entry.first);
+                if (!wf || wf->spamFreq != entry.second.first || wf->hamFreq != entry.second.second) {
+                    return false;
+                }
+            }
+            return true;
+        };
+
+        double logMicros, compactedMicros, reopenedMicros;
+        size_t recordsBefore = log.getRecordCount();
+        bool logOk = replayMatches(log, logMicros);
+        bool compacted = log.needsCompaction() && log.compact();
+        bool compactedOk = replayMatches(log, compactedMicros);
+        log.close();
+
+        // A crash in the middle of an append leaves part of a record behind
+        {
+            ofstream torn(logFile, ios::binary | ios::app);
+            torn.write("\x40\x00\x00\x00garbage", 11);
+        }
+        FeedbackLog reopened;
+        bool reopenedOk = reopened.open(logFile) && replayMatches(reopened, reopenedMicros);
+        reopened.close();
+        remove(logFile.c_str());
+
+        cout << "\nFeedback log: " << recordsBefore << " records replayed in " << logMicros << " us"
+             << (logOk ? "" : "  TOTALS DIFFER") << endl;
+        cout << "After compaction: " << reopened.getRecordCount() << " record(s) replayed in " << compactedMicros << " us"
+             << (compacted && compactedOk ? "" : "  COMPACTION FAILED")
+             << (reopenedOk ? "" : "  TORN RECORD NOT RECOVERED") << endl;
+        if (!logOk || !compacted || !compactedOk || !reopenedOk) {
+            cerr << "Error: feedback log replay gave the wrong totals" << endl;
+            return 1;
+        }
+    }
+
+    // A reload into a cleared arena map reuses its buckets and nodes, so it
+    // must allocate less than once per word; the loader's own few allocations
+    // are the rest. A Chaining map reloaded the same way allocates a node
+    // for every word, for comparison.
+    auto reloadStart = chrono::steady_clock::now();
+    size_t arenaBefore = allocationCount;
+    arenaMap.clear();
+    loadWordFrequenciesFromTransposedCSV("final.csv", &arenaMap);
+    size_t arenaAllocations = allocationCount - arenaBefore;
+    auto reloadEnd = chrono::steady_clock::now();
+    size_t chainBefore = allocationCount;
+    chainMap.clear();
+    loadWordFrequenciesFromTransposedCSV("final.csv", &chainMap);
+    size_t chainAllocations = allocationCount - chainBefore;
+    cout << "Arena Chaining clear + reload: " << chrono::duration<double, micro>(reloadEnd - reloadStart).count()
+         << " us (" << arenaMap.getCount() << " words), " << arenaAllocations << " heap allocations against "
+         << chainAllocations << " for Chaining" << endl;
+    if (arenaAllocations >= (size_t)arenaMap.getCount()) {
+        cerr << "Error: reloading the arena map allocated per word" << endl;
+        return 1;
+    }
+
+    cout << "\nCompiling final.csv into final.model..." << endl;
+    if (!compileModel("final.csv", "final.model")) {
+        return 1;
+    }
+
+    auto csvStart = chrono::steady_clock::now();
+    ChainingHashMap csvMap(2000);
+    loadWordFrequenciesFromTransposedCSV("final.csv", &csvMap);
+    auto csvEnd = chrono::steady_clock::now();
+
+    CompiledModel compiledModel;
+    auto mapStart = chrono::steady_clock::now();
+    bool mapped = compiledModel.open("final.model");
+    auto mapEnd = chrono::steady_clock::now();
+    if (!mapped) {
+        return 1;
+    }
+
+    cout << "CSV load: " << chrono::duration<double, micro>(csvEnd - csvStart).count() << " us" << endl;
+    cout << "Compiled model open: " << chrono::duration<double, micro>(mapEnd - mapStart).count() << " us"
+         << " (" << compiledModel.getCount() << " words)" << endl;
+
+    printTableStats(cout, "Compiled Model", compiledModel.getStats());
+    EmailClassifier compiledClassifier(&compiledModel);
+    testClassifier("Compiled Model", compiledClassifier, testEmails);
+
+    // open() only checks the header, so a damaged index must fail lookups, not hang them
+    {
+        ifstream imageFile("final.model", ios::binary);
+        string image((istreambuf_iterator<char>(imageFile)), istreambuf_iterator<char>());
+        CompiledModelHeader damagedHeader;
+        memcpy(&damagedHeader, image.data(), sizeof(damagedHeader));
+        memset(&image[damagedHeader.indexOffset], 0xff, damagedHeader.indexSize * sizeof(uint32_t));
+        ofstream("final.damaged.model", ios::binary) << image;
+
+        CompiledModel damagedModel;
+        bool damagedOpened = damagedModel.open("final.damaged.model");
+        bool damagedFound = damagedOpened && damagedModel.search("free") != nullptr;
+        damagedModel.close();
+        remove("final.damaged.model");
+        if (!damagedOpened || damagedFound) {
+            cerr << "Error: damaged compiled model was not handled" << endl;
+            return 1;
+        }
+        cout << "Damaged compiled model index: lookups miss" << endl;
+    }
+
+    size_t compiledAllocations = countClassifyAllocations(compiledClassifier, emailTokens);
+    cout << "Heap allocations while classifying with the Compiled Model: " << compiledAllocations << endl;
+    if (!allocationFree || compiledAllocations != 0) {
+        cerr << "Error: classify allocated memory" << endl;
+        return 1;
     }
-    cout << "Accuracy: " << (double)correctPredictions/testEmails.size() * 100 << "%" << endl;
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,970 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <iomanip>
+#include "stats.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define HASHMAP_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+using namespace std;
+
+const float NO_SPAM_SCORE = -1.0f;     //a word seen in neither spam nor ham
+
+// The share of a word's occurrences that were in spam, or NO_SPAM_SCORE.
+// Computed once when a word's counts change rather than on every lookup.
+inline float wordSpamScore(double spamFreq, double hamFreq) {
+    double totalFreq = spamFreq + hamFreq;
+    return totalFreq > 0 ? (float)(spamFreq / totalFreq) : NO_SPAM_SCORE;
+}
+
+// Code that changes spamFreq or hamFreq directly must call updateScore()
+struct WordFreq {
+    string word;
+    double spamFreq;
+    double hamFreq;
+    float spamScore;
+
+    WordFreq(string w = "", double s = 0.0, double h = 0.0)
+        : word(w), spamFreq(s), hamFreq(h), spamScore(wordSpamScore(s, h)) {}
+
+    void addCounts(double spam, double ham) {
+        spamFreq += spam;
+        hamFreq += ham;
+        updateScore();
+    }
+
+    void updateScore() { spamScore = wordSpamScore(spamFreq, hamFreq); }
+    float getSpamScore() const { return spamScore; }
+};
+
+struct Node {
+    WordFreq data;
+    Node* next;
+
+    Node(WordFreq d) : data(d), next(nullptr) {}
+};
+
+// Hash functions a map can be built with. Each returns a full 64-bit value
+// and the map keeps as many low bits as it needs.
+typedef uint64_t (*HashFunction)(string_view key);
+
+// The original hash: hashVal = 37 * hashVal + c, one byte at a time.
+// Kept for comparison; computed unsigned so that overflow just wraps.
+inline uint64_t polynomialHash37(string_view key) {
+    uint64_t hashVal = 0;
+    for (char c : key) {
+        hashVal = 37 * hashVal + (unsigned char)c;    //Why 37? Answered in ReadME file
+    }
+    return hashVal;
+}
+
+// 64x64 -> 128 bit multiply, folded back to 64 bits
+inline uint64_t multiplyFold64(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t high;
+    uint64_t low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    uint64_t aLow = (uint32_t)a, aHigh = a >> 32, bLow = (uint32_t)b, bHigh = b >> 32;
+    uint64_t lowLow = aLow * bLow, lowHigh = aLow * bHigh, highLow = aHigh * bLow, highHigh = aHigh * bHigh;
+    uint64_t middle = (lowLow >> 32) + (uint32_t)lowHigh + (uint32_t)highLow;
+    uint64_t low = (middle << 32) | (uint32_t)lowLow;
+    uint64_t high = highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+    return low ^ high;
+#endif
+}
+
+inline uint64_t readBytes64(const char* p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint64_t readBytes32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Default hash, in the style of wyhash: reads the key 4 or 8 bytes at a time
+// and mixes with 128-bit multiplies, so short words cost a couple of
+// multiplies and every output bit depends on every input byte.
+inline uint64_t wordHash64(string_view key) {
+    const uint64_t P0 = 0xa0761d6478bd642fULL;
+    const uint64_t P1 = 0xe7037ed1a0b428dbULL;
+    const char* p = key.data();
+    size_t length = key.size();
+    uint64_t seed = P0;
+    uint64_t a, b;
+
+    if (length <= 16) {
+        if (length >= 4) {
+            size_t shift = (length >> 3) << 2;
+            a = (readBytes32(p) << 32) | readBytes32(p + shift);
+            b = (readBytes32(p + length - 4) << 32) | readBytes32(p + length - 4 - shift);
+        }
+        else if (length > 0) {
+            a = ((uint64_t)(unsigned char)p[0] << 16) | ((uint64_t)(unsigned char)p[length >> 1] << 8) | (unsigned char)p[length - 1];
+            b = 0;
+        }
+        else {
+            a = b = 0;
+        }
+    }
+    else {
+        size_t remaining = length;
+        while (remaining > 16) {
+            seed = multiplyFold64(readBytes64(p) ^ P1, readBytes64(p + 8) ^ seed);
+            p += 16;
+            remaining -= 16;
+        }
+        a = readBytes64(p + remaining - 16);
+        b = readBytes64(p + remaining - 8);
+    }
+    return multiplyFold64(P1 ^ length, multiplyFold64(a ^ P1, b ^ seed));
+}
+
+inline void prefetchAddress(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address);
+#elif defined(HASHMAP_USE_SSE2)
+    _mm_prefetch((const char*)address, _MM_HINT_T0);
+#else
+    (void)address;
+#endif
+}
+
+class HashMap {
+protected:
+    int size;        //total number of buckets in table, always a power of two
+    int count;      //number of words stored (not buckets used; see getStats)
+    HashFunction hashFunction;
+
+    static int roundUpToPowerOfTwo(int s) {
+        int capacity = 1;
+        while (capacity < s) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
+
+    // size is a power of two, so the modulo is just a mask
+    int hash(string_view key) {
+        return (int)(hashCode(key) & (size - 1));
+    }
+
+public:
+    HashMap(int s = 997, HashFunction h = wordHash64) : size(roundUpToPowerOfTwo(s)), count(0), hashFunction(h) {}      //Initially, since we do not have the maximum count of target words(words except is, this, the, in, or ....), we choose a random number
+    virtual ~HashMap() {}
+
+    virtual void insert(WordFreq data) = 0;
+    // Takes a view so callers can look up slices of a larger buffer without copying
+    virtual WordFreq* search(string_view key) = 0;
+    virtual void clear() = 0;
+
+    // Batch lookups hash a key early, prefetch the memory its lookup will touch,
+    // and resolve it a few keys later with the same hash value. prefetchEntry
+    // is the second stage, called once prefetch's memory has arrived: it reads
+    // that memory and prefetches what it points to, such as a chain's first node.
+    uint64_t hashCode(string_view key) {
+        return hashFunction(key);
+    }
+    virtual void prefetch(uint64_t) {}
+    virtual void prefetchEntry(uint64_t) {}
+    virtual WordFreq* searchHashed(string_view key, uint64_t) { return search(key); }
+
+    // Maps that resize incrementally move the rest of the old table now
+    virtual void finishRehash() {}
+
+    // Walks the table; costs a pass over every bucket, so call it for
+    // reporting rather than per lookup
+    virtual TableStats getStats() = 0;
+
+    // Words per bucket. For the chaining maps that is the average chain
+    // length; getStats().occupancy() is the share of buckets in use.
+    double getLoadFactor() { return (double)count / size; }
+    int getCount() { return count; }
+};
+
+// Grows when there are more words than buckets. The new table is filled a few
+// old buckets at a time on each insert, so no single insert pays for the
+// whole rehash. Until an old bucket has been moved its keys stay there.
+class ChainingHashMap final : public HashMap {
+private:
+    enum { REHASH_STEP = 4 };    //old buckets moved per insert
+
+    vector<Node*> table;
+    vector<Node*> oldTable;      //non-empty while a resize is in progress
+    int migrateIndex;            //old buckets below this have been moved
+
+    Node*& bucketFor(uint64_t hashVal) {
+        if (!oldTable.empty()) {
+            int oldIndex = (int)(hashVal & (oldTable.size() - 1));
+            if (oldIndex >= migrateIndex) {
+                return oldTable[oldIndex];
+            }
+        }
+        return table[hashVal & (size - 1)];
+    }
+
+    void startResize() {
+        oldTable.swap(table);
+        size *= 2;
+        table.assign(size, nullptr);
+        migrateIndex = 0;
+    }
+
+    void migrateBuckets(int buckets) {
+        while (buckets-- > 0 && migrateIndex < (int)oldTable.size()) {
+            Node* current = oldTable[migrateIndex];
+            oldTable[migrateIndex] = nullptr;
+            migrateIndex++;
+
+            while (current) {
+                Node* next = current->next;
+                int index = hash(current->data.word);
+                current->next = table[index];
+                table[index] = current;
+                current = next;
+            }
+        }
+        if (!oldTable.empty() && migrateIndex == (int)oldTable.size()) {
+            vector<Node*>().swap(oldTable);
+            migrateIndex = 0;
+        }
+    }
+
+public:
+    ChainingHashMap(int s = 997, HashFunction h = wordHash64) : HashMap(s, h), migrateIndex(0) {
+        table.resize(size, nullptr);
+    }
+
+    ~ChainingHashMap() {
+        clear();
+    }
+
+    void insert(WordFreq data) override {
+        migrateBuckets(REHASH_STEP);
+
+        uint64_t hashVal = hashCode(data.word);
+        Node** link = &bucketFor(hashVal);
+        while (*link) {
+            if ((*link)->data.word == data.word) {
+                (*link)->data = data;
+                return;
+            }
+            link = &(*link)->next;
+        }
+
+        if (count + 1 > size) {
+            finishRehash();
+            startResize();
+            link = &bucketFor(hashVal);
+        }
+
+        Node* newNode = new Node(data);
+        newNode->next = *link;
+        *link = newNode;
+        count++;
+    }
+
+    WordFreq* search(string_view key) override {
+        return searchHashed(key, hashCode(key));
+    }
+
+    void prefetch(uint64_t hashVal) override {
+        prefetchAddress(&bucketFor(hashVal));
+    }
+
+    void prefetchEntry(uint64_t hashVal) override {
+        Node* first = bucketFor(hashVal);
+        if (first) {
+            prefetchAddress(first);
+        }
+    }
+
+    WordFreq* searchHashed(string_view key, uint64_t hashVal) override {
+        Node* current = bucketFor(hashVal);
+
+        while (current) {
+            if (current->data.word == key) {
+                return &(current->data);
+            }
+            current = current->next;
+        }
+        return nullptr;
+    }
+
+    void finishRehash() override {
+        migrateBuckets((int)oldTable.size());
+    }
+
+    TableStats getStats() override {
+        TableStats stats;
+        for (vector<Node*>* buckets : {&table, &oldTable}) {
+            int first = buckets == &oldTable ? migrateIndex : 0;
+            for (int i = first; i < (int)buckets->size(); i++) {
+                size_t length = 0;
+                for (Node* node = (*buckets)[i]; node; node = node->next) {
+                    addToHistogram(stats.probeLengths, ++length);
+                }
+                addToHistogram(stats.chainLengths, length);
+                stats.buckets++;
+                stats.words += length;
+                stats.usedBuckets += length > 0;
+            }
+        }
+        return stats;
+    }
+
+    void clear() override {
+        for (vector<Node*>* buckets : {&table, &oldTable}) {
+            for (Node* head : *buckets) {
+                while (head) {
+                    Node* temp = head;
+                    head = head->next;
+                    delete temp;
+                }
+            }
+        }
+        table.assign(size, nullptr);
+        vector<Node*>().swap(oldTable);
+        migrateIndex = 0;
+        count = 0;
+    }
+};
+
+
+// Linear probing that grows once the table is 70% full. Old slots are copied
+// across a few at a time on each insert; until the resize finishes, a key
+// missing from the new table is looked up in the old one.
+class OpenAddressingHashMap final : public HashMap {
+private:
+    enum { REHASH_STEP = 8 };    //old slots copied per insert
+
+    vector<pair<bool, WordFreq>> table;
+    vector<pair<bool, WordFreq>> oldTable;     //non-empty while a resize is in progress
+    int migrateIndex;
+
+    // Index of key in slots, or of the empty slot where it belongs; -1 if the table is full
+    static int locate(vector<pair<bool, WordFreq>>& slots, string_view key, uint64_t hashVal) {
+        int mask = (int)slots.size() - 1;
+        for (int i = 0; i < (int)slots.size(); i++) {
+            int currentIndex = (int)((hashVal + i) & mask);
+            if (!slots[currentIndex].first || slots[currentIndex].second.word == key) {
+                return currentIndex;
+            }
+        }
+        return -1;
+    }
+
+    void startResize() {
+        oldTable.swap(table);
+        size *= 2;
+        table.assign(size, {false, WordFreq()});
+        migrateIndex = 0;
+    }
+
+    // Old slots are copied, not moved, so probe sequences through the old
+    // table stay intact until it is dropped
+    void migrateSlots(int slots) {
+        while (slots-- > 0 && migrateIndex < (int)oldTable.size()) {
+            pair<bool, WordFreq>& slot = oldTable[migrateIndex++];
+            if (slot.first) {
+                int index = locate(table, slot.second.word, hashCode(slot.second.word));
+                if (!table[index].first) {
+                    table[index] = slot;
+                }
+            }
+        }
+        if (!oldTable.empty() && migrateIndex == (int)oldTable.size()) {
+            vector<pair<bool, WordFreq>>().swap(oldTable);
+            migrateIndex = 0;
+        }
+    }
+
+public:
+    OpenAddressingHashMap(int s = 997, HashFunction h = wordHash64) : HashMap(s, h), migrateIndex(0) {
+        table.resize(size, {false, WordFreq()});
+    }
+
+    void insert(WordFreq data) override {
+        migrateSlots(REHASH_STEP);
+
+        uint64_t hashVal = hashCode(data.word);
+        int index = locate(table, data.word, hashVal);
+        if (index >= 0 && table[index].first) {
+            table[index].second = data;
+            return;
+        }
+
+        bool known = false;
+        if (!oldTable.empty()) {
+            int oldIndex = locate(oldTable, data.word, hashVal);
+            known = oldIndex >= 0 && oldTable[oldIndex].first;
+        }
+
+        if (!known && (count + 1) * 10 > size * 7) {
+            finishRehash();
+            startResize();
+            index = locate(table, data.word, hashVal);
+        }
+
+        if (index < 0) {
+            cout << "Hash table is full!" << endl;
+            return;
+        }
+        table[index] = {true, data};
+        if (!known) {
+            count++;
+        }
+    }
+
+    WordFreq* search(string_view key) override {
+        return searchHashed(key, hashCode(key));
+    }
+
+    // A slot is a 64-byte pair, so it usually spans two cache lines
+    void prefetch(uint64_t hashVal) override {
+        const pair<bool, WordFreq>* slot = &table[hashVal & (size - 1)];
+        prefetchAddress(slot);
+        prefetchAddress((const char*)(slot + 1) - 1);
+    }
+
+    // Words too long for the string's inline buffer live on the heap
+    void prefetchEntry(uint64_t hashVal) override {
+        const pair<bool, WordFreq>& slot = table[hashVal & (size - 1)];
+        if (slot.first) {
+            prefetchAddress(slot.second.word.data());
+        }
+    }
+
+    WordFreq* searchHashed(string_view key, uint64_t hashVal) override {
+        int index = locate(table, key, hashVal);
+        if (index >= 0 && table[index].first) {
+            return &(table[index].second);
+        }
+
+        if (!oldTable.empty()) {
+            index = locate(oldTable, key, hashVal);
+            if (index >= 0 && oldTable[index].first) {
+                return &(oldTable[index].second);
+            }
+        }
+        return nullptr;
+    }
+
+    void finishRehash() override {
+        migrateSlots((int)oldTable.size());
+    }
+
+    // A word's probe length is how far past its home slot it sits, plus one
+    TableStats getStats() override {
+        TableStats stats;
+        for (vector<pair<bool, WordFreq>>* slots : {&table, &oldTable}) {
+            int first = slots == &oldTable ? migrateIndex : 0;
+            int mask = (int)slots->size() - 1;
+            stats.buckets += slots->size() - first;
+            for (int i = first; i < (int)slots->size(); i++) {
+                if (!(*slots)[i].first) {
+                    continue;
+                }
+                // An old slot whose word was written again since the resize
+                // started is a stale copy
+                uint64_t hashVal = hashCode((*slots)[i].second.word);
+                if (slots == &oldTable && searchHashed((*slots)[i].second.word, hashVal) != &(*slots)[i].second) {
+                    continue;
+                }
+                int home = (int)(hashVal & mask);
+                addToHistogram(stats.probeLengths, (size_t)((i - home) & mask) + 1);
+                stats.words++;
+                stats.usedBuckets++;
+            }
+        }
+        return stats;
+    }
+
+    void clear() override {
+        table.clear();
+        table.resize(size, {false, WordFreq()});
+        vector<pair<bool, WordFreq>>().swap(oldTable);
+        migrateIndex = 0;
+        count = 0;
+    }
+};
+
+inline int lowestSetBit(uint32_t bits) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, bits);
+    return (int)index;
+#else
+    return __builtin_ctz(bits);
+#endif
+}
+
+// Bit i is set when control byte i of the 16 starting at group equals value
+inline uint32_t matchControlGroup(const int8_t* group, int8_t value) {
+#ifdef HASHMAP_USE_SSE2
+    __m128i bytes = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(value)));
+#else
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++) {
+        if (group[i] == value) {
+            bits |= 1u << i;
+        }
+    }
+    return bits;
+#endif
+}
+
+// SwissTable-style open addressing. Every slot has one control byte: EMPTY, or
+// the low 7 bits of the key's hash when the slot is full. A lookup loads 16
+// control bytes at once, compares them all against the hash fragment with SSE2
+// and only compares strings for the slots that matched, so most probes never
+// touch the WordFreq array at all. Keys stay in the WordFreq slots: a hit
+// then reads the key and the score from the same cache line, which measured
+// faster than a separate key array.
+class FlatHashMap final : public HashMap {
+private:
+    enum { GROUP_WIDTH = 16, EMPTY = -128 };
+
+    vector<int8_t> ctrl;         //one control byte per slot, kept apart from the entries
+    vector<WordFreq> slots;
+
+    uint32_t matchGroup(int group, int8_t value) const {
+        return matchControlGroup(&ctrl[group], value);
+    }
+
+    // Returns the slot holding key, or -1. Groups are visited in triangular
+    // order, which covers every group when the group count is a power of two.
+    int findSlot(string_view key, uint64_t hashVal) const {
+        int mask = size - 1;
+        int group = (int)(hashVal >> 7) & mask & ~(GROUP_WIDTH - 1);
+        int8_t fragment = (int8_t)(hashVal & 0x7f);
+
+        for (int step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+            uint32_t matches = matchGroup(group, fragment);
+            while (matches) {
+                int slot = group + lowestSetBit(matches);
+                if (slots[slot].word == key) {
+                    return slot;
+                }
+                matches &= matches - 1;
+            }
+            if (matchGroup(group, EMPTY)) {
+                return -1;
+            }
+            if (step >= size) {
+                return -1;
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    int findEmptySlot(uint64_t hashVal) const {
+        int mask = size - 1;
+        int group = (int)(hashVal >> 7) & mask & ~(GROUP_WIDTH - 1);
+
+        for (int step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+            uint32_t empties = matchGroup(group, EMPTY);
+            if (empties) {
+                return group + lowestSetBit(empties);
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    void grow() {
+        vector<WordFreq> oldSlots;
+        oldSlots.swap(slots);
+        vector<int8_t> oldCtrl;
+        oldCtrl.swap(ctrl);
+
+        size *= 2;
+        ctrl.assign(size, EMPTY);
+        slots.resize(size);
+
+        for (size_t i = 0; i < oldSlots.size(); i++) {
+            if (oldCtrl[i] != EMPTY) {
+                uint64_t hashVal = hashCode(oldSlots[i].word);
+                int slot = findEmptySlot(hashVal);
+                ctrl[slot] = (int8_t)(hashVal & 0x7f);
+                slots[slot] = std::move(oldSlots[i]);
+            }
+        }
+    }
+
+public:
+    FlatHashMap(int s = 997, HashFunction h = wordHash64) : HashMap(s < GROUP_WIDTH ? GROUP_WIDTH : s, h) {
+        ctrl.assign(size, EMPTY);
+        slots.resize(size);
+    }
+
+    void insert(WordFreq data) override {
+        uint64_t hashVal = hashCode(data.word);
+        int slot = findSlot(data.word, hashVal);
+        if (slot >= 0) {
+            slots[slot] = data;
+            return;
+        }
+
+        // Keep at least 1/8 of the slots empty so misses stop early
+        if ((count + 1) * 8 > size * 7) {
+            grow();
+        }
+        slot = findEmptySlot(hashVal);
+        ctrl[slot] = (int8_t)(hashVal & 0x7f);
+        slots[slot] = data;
+        count++;
+    }
+
+    WordFreq* search(string_view key) override {
+        return searchHashed(key, hashCode(key));
+    }
+
+    // The control group is read first; the group's 16 entries span 14 cache
+    // lines, so the entry is only prefetched once the group says which one
+    void prefetch(uint64_t hashVal) override {
+        int group = (int)(hashVal >> 7) & (size - 1) & ~(GROUP_WIDTH - 1);
+        prefetchAddress(&ctrl[group]);
+    }
+
+    void prefetchEntry(uint64_t hashVal) override {
+        int group = (int)(hashVal >> 7) & (size - 1) & ~(GROUP_WIDTH - 1);
+        uint32_t matches = matchGroup(group, (int8_t)(hashVal & 0x7f));
+        if (matches) {
+            prefetchAddress(&slots[group + lowestSetBit(matches)]);
+        }
+    }
+
+    WordFreq* searchHashed(string_view key, uint64_t hashVal) override {
+        int slot = findSlot(key, hashVal);
+        return slot >= 0 ? &slots[slot] : nullptr;
+    }
+
+    // Probes are counted in groups of GROUP_WIDTH slots, as findSlot visits them
+    TableStats getStats() override {
+        TableStats stats;
+        stats.buckets = size;
+        int mask = size - 1;
+        for (int i = 0; i < size; i++) {
+            if (ctrl[i] == EMPTY) {
+                continue;
+            }
+            uint64_t hashVal = hashCode(slots[i].word);
+            int group = (int)(hashVal >> 7) & mask & ~(GROUP_WIDTH - 1);
+            size_t probes = 1;
+            for (int step = GROUP_WIDTH; i < group || i >= group + GROUP_WIDTH; step += GROUP_WIDTH) {
+                group = (group + step) & mask;
+                probes++;
+            }
+            addToHistogram(stats.probeLengths, probes);
+            stats.words++;
+            stats.usedBuckets++;
+        }
+        return stats;
+    }
+
+    void clear() override {
+        ctrl.assign(size, EMPTY);
+        slots.assign(size, WordFreq());
+        count = 0;
+    }
+};
+
+
+// Chaining without a heap node per word. Each bucket stores its first few
+// entries inline; further entries spill into nodes taken from one contiguous
+// arena and are linked by index. clear() only bumps a generation number, so
+// buckets and arena nodes (and the string buffers inside them) are reused by
+// the next load instead of being freed and allocated again. A key longer than
+// the small string limit still allocates its std::string the first time an
+// entry holds a key that long; later loads reuse that buffer.
+class ArenaChainingHashMap final : public HashMap {
+private:
+    enum { INLINE_ENTRIES = 2, NO_NODE = -1 };
+
+    struct OverflowNode {
+        WordFreq data;
+        int next;
+    };
+
+    struct Bucket {
+        unsigned generation;     //bucket is empty unless this matches the map's generation
+        int used;                //inline entries in use
+        int overflow;            //first spilled node in the arena, or NO_NODE
+        WordFreq entries[INLINE_ENTRIES];
+
+        Bucket() : generation(0), used(0), overflow(NO_NODE) {}
+    };
+
+    vector<Bucket> table;
+    vector<OverflowNode> arena;
+    int arenaUsed;
+    unsigned generation;
+
+    int allocateNode() {
+        if (arenaUsed == (int)arena.size()) {
+            arena.resize(arena.empty() ? 64 : arena.size() * 2);
+        }
+        return arenaUsed++;
+    }
+
+public:
+    ArenaChainingHashMap(int s = 997, HashFunction h = wordHash64) : HashMap(s, h), arenaUsed(0), generation(1) {
+        table.resize(size);
+    }
+
+    void insert(WordFreq data) override {
+        Bucket& bucket = table[hash(data.word)];
+        if (bucket.generation != generation) {
+            bucket.generation = generation;
+            bucket.used = 0;
+            bucket.overflow = NO_NODE;
+        }
+
+        for (int i = 0; i < bucket.used; i++) {
+            if (bucket.entries[i].word == data.word) {
+                bucket.entries[i] = data;
+                return;
+            }
+        }
+
+        int last = NO_NODE;
+        for (int node = bucket.overflow; node != NO_NODE; node = arena[node].next) {
+            if (arena[node].data.word == data.word) {
+                arena[node].data = data;
+                return;
+            }
+            last = node;
+        }
+
+        if (bucket.used < INLINE_ENTRIES) {
+            bucket.entries[bucket.used++] = data;
+            count++;
+            return;
+        }
+
+        int node = allocateNode();
+        arena[node].data = data;
+        arena[node].next = NO_NODE;
+        if (last == NO_NODE) {
+            bucket.overflow = node;
+        }
+        else {
+            arena[last].next = node;
+        }
+        count++;
+    }
+
+    WordFreq* search(string_view key) override {
+        return searchHashed(key, hashCode(key));
+    }
+
+    // A bucket with its inline entries spans two or three cache lines
+    void prefetch(uint64_t hashVal) override {
+        const Bucket* bucket = &table[hashVal & (size - 1)];
+        for (const char* line = (const char*)bucket; line < (const char*)(bucket + 1); line += 64) {
+            prefetchAddress(line);
+        }
+    }
+
+    void prefetchEntry(uint64_t hashVal) override {
+        const Bucket& bucket = table[hashVal & (size - 1)];
+        if (bucket.generation == generation && bucket.overflow != NO_NODE) {
+            prefetchAddress(&arena[bucket.overflow]);
+        }
+    }
+
+    WordFreq* searchHashed(string_view key, uint64_t hashVal) override {
+        Bucket& bucket = table[hashVal & (size - 1)];
+        if (bucket.generation != generation) {
+            return nullptr;
+        }
+
+        for (int i = 0; i < bucket.used; i++) {
+            if (bucket.entries[i].word == key) {
+                return &bucket.entries[i];
+            }
+        }
+        for (int node = bucket.overflow; node != NO_NODE; node = arena[node].next) {
+            if (arena[node].data.word == key) {
+                return &arena[node].data;
+            }
+        }
+        return nullptr;
+    }
+
+    TableStats getStats() override {
+        TableStats stats;
+        stats.buckets = size;
+        for (Bucket& bucket : table) {
+            size_t length = 0;
+            if (bucket.generation == generation) {
+                for (int i = 0; i < bucket.used; i++) {
+                    addToHistogram(stats.probeLengths, ++length);
+                }
+                for (int node = bucket.overflow; node != NO_NODE; node = arena[node].next) {
+                    addToHistogram(stats.probeLengths, ++length);
+                }
+            }
+            addToHistogram(stats.chainLengths, length);
+            stats.words += length;
+            stats.usedBuckets += length > 0;
+        }
+        return stats;
+    }
+
+    void clear() override {
+        generation++;
+        if (generation == 0) {
+            // Wrapped around: stale buckets could look current again
+            for (Bucket& bucket : table) {
+                bucket.generation = 0;
+            }
+            generation = 1;
+        }
+        arenaUsed = 0;
+        count = 0;
+    }
+};
+
+
+inline vector<string> splitCSVLine(const string& line) {
+    vector<string> tokens;
+    stringstream ss(line);
+    string token;
+
+    while (getline(ss, token, ',')) {
+        if (!token.empty() && token.front() == '"' && token.back() == '"') {
+            token = token.substr(1, token.length() - 2);
+        }
+        tokens.push_back(token);
+    }
+    return tokens;
+}
+
+// Reads the transposed model CSV (row 1: words, row 2: spam counts, row 3: ham counts)
+inline bool readWordFrequenciesFromTransposedCSV(const string& filename, vector<WordFreq>& wordFreqs) {
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Error opening file: " << filename << endl;
+        return false;
+    }
+
+    string wordsLine, spamLine, hamLine;
+    getline(file, wordsLine);
+    getline(file, spamLine);
+    getline(file, hamLine);
+
+    vector<string> words = splitCSVLine(wordsLine);
+    vector<string> spamCounts = splitCSVLine(spamLine);
+    vector<string> hamCounts = splitCSVLine(hamLine);
+
+    if (words.size() != spamCounts.size() || words.size() != hamCounts.size()) {
+        cerr << "Error: Inconsistent number of columns in CSV file" << endl;
+        cerr << "Words: " << words.size() << ", Spam counts: " << spamCounts.size() << ", Ham counts: " << hamCounts.size() << endl;
+        return false;
+    }
+
+    for (size_t i = 0; i < words.size(); ++i) {
+        if (words[i].empty() || words[i] == "Word" || words[i] == "word") {
+            continue;
+        }
+
+        try {
+            double spamFreq = stod(spamCounts[i]);
+            double hamFreq = stod(hamCounts[i]);
+
+            wordFreqs.push_back(WordFreq(words[i], spamFreq, hamFreq));
+        } catch (const exception& e) {
+            cerr << "Error processing column " << i + 1 << ": " << words[i] << endl;
+            cerr << "Error message: " << e.what() << endl;
+            continue;
+        }
+    }
+
+    file.close();
+    return true;
+}
+
+// Writes contents next to filename and renames it into place, so readers
+// never see half a file
+inline bool replaceFileContents(const string& filename, const string& contents) {
+    string tempFile = filename + ".tmp";
+    ofstream out(tempFile, ios::binary | ios::trunc);
+    if (!out.is_open()) {
+        cerr << "Error opening file for writing: " << tempFile << endl;
+        return false;
+    }
+    out.write(contents.data(), contents.size());
+    out.close();
+    if (!out) {
+        cerr << "Error writing file: " << tempFile << endl;
+        remove(tempFile.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    remove(filename.c_str());
+#endif
+    if (rename(tempFile.c_str(), filename.c_str()) != 0) {
+        cerr << "Error replacing file: " << filename << endl;
+        remove(tempFile.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Writes the transposed model CSV that readWordFrequenciesFromTransposedCSV reads
+inline bool writeWordFrequenciesToTransposedCSV(const string& filename, const vector<WordFreq>& wordFreqs) {
+    ostringstream words, spamCounts, hamCounts;
+    spamCounts << setprecision(17);
+    hamCounts << setprecision(17);
+    for (size_t i = 0; i < wordFreqs.size(); ++i) {
+        const char* separator = i == 0 ? "" : ",";
+        words << separator << wordFreqs[i].word;
+        spamCounts << separator << wordFreqs[i].spamFreq;
+        hamCounts << separator << wordFreqs[i].hamFreq;
+    }
+    return replaceFileContents(filename, words.str() + "\n" + spamCounts.str() + "\n" + hamCounts.str() + "\n");
+}
+
+// Map is HashMap or any class with the same insert and finishRehash
+template <class Map>
+bool loadWordFrequenciesFromTransposedCSV(const string& filename, Map* wordMap) {
+    vector<WordFreq> wordFreqs;
+    if (!readWordFrequenciesFromTransposedCSV(filename, wordFreqs)) {
+        return false;
+    }
+
+    for (const WordFreq& wordFreq : wordFreqs) {
+        wordMap->insert(wordFreq);
+    }
+    wordMap->finishRehash();
+    return true;
+}
+
+#endif
@@ -1,308 +1,231 @@
-#include <iostream>
-#include <string>
-#include <vector>
-#include <fstream>
-#include <sstream>
+#include "classifier.h"
+#include "feedback.h"
+#include "tokenizer.h"
 #include <gtk/gtk.h>
 #include <algorithm>
-
-using namespace std;
-
-struct WordFreq {
-    string word;
-    double spamFreq;
-    double hamFreq;
-
-    WordFreq(string w = "", double s = 0.0, double h = 0.0)
-        : word(w), spamFreq(s), hamFreq(h) {}
-};
-
-struct Node {
-    WordFreq data;
-    Node* next;
-
-    Node(WordFreq d) : data(d), next(nullptr) {}
+#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+const string MODEL_FILE = "C:\\Users\\Komal yadav\\major_dsa\\test.csv";
+const string COMPILED_MODEL_FILE = "C:\\Users\\Komal yadav\\major_dsa\\test.model";     //built from MODEL_FILE by modelc
+const string FEEDBACK_LOG_FILE = "C:\\Users\\Komal yadav\\major_dsa\\test.feedback";   //emails marked as spam / not spam
+
+// One fully loaded model: the trained CSV plus the feedback log. A snapshot
+// is never modified after it is published, so classifications read it
+// without locks. Feedback and changes to the CSV both build a new snapshot
+// in the background, which replaces the current one.
+struct ModelSnapshot {
+    ChainingHashMap chainMap;
+    OpenAddressingHashMap openMap;
+    CompiledModel compiledModel;      //only used when COMPILED_MODEL_FILE exists; feedback is not applied to it
+
+    ModelSnapshot() : chainMap(2000), openMap(2000) {}
 };
 
-class HashMap {
-protected:
-    int size;        //total number of buckets in table
-    int count;      //count measures the number of buckets used.
-
-
-    int hash(string key) {
-        int hashVal = 0;
-        for (char c : key) {
-            hashVal = 37 * hashVal + c;    //Why 37? Answered in ReadME file
-        }
-        return abs(hashVal) % size;
+shared_ptr<ModelSnapshot> currentModel;     //always accessed through atomic_load/atomic_store
+atomic<bool> reloadPending(false);
+atomic<bool> reloadRunning(false);
+
+FeedbackLog feedbackLog;
+atomic<bool> compactionRunning(false);
+
+// Reload, compaction, feedback and classification run on detached threads. They are
+// counted so that main can wait for them once the window is closed, before
+// it prints the stats and returns.
+atomic<bool> shuttingDown(false);           //set after gtk_main returns; loops stop taking new work
+mutex backgroundLock;                       //guards the count below
+condition_variable backgroundDone;
+int backgroundThreads = 0;
+
+void startBackgroundThread(function<void()> work) {
+    {
+        lock_guard<mutex> guard(backgroundLock);
+        backgroundThreads++;
     }
+    thread([work]() {
+        work();
+        lock_guard<mutex> guard(backgroundLock);
+        backgroundThreads--;
+        backgroundDone.notify_all();
+    }).detach();
+}
 
-public:
-    HashMap(int s = 997) : size(s), count(0) {}      //Initially, since we do not have the maximum count of target words(words except is, this, the, in, or ....), we choose a random number
-    virtual ~HashMap() {}
-
-    virtual void insert(WordFreq data) = 0;
-    virtual WordFreq* search(string key) = 0;
-    virtual void clear() = 0;
-
-    double getLoadFactor() { return (double)count / size; }
-    int getCount() { return count; }
-};
-
-
-class ChainingHashMap : public HashMap {
-private:
-    vector<Node*> table;
-
-public:
-    ChainingHashMap(int s = 997) : HashMap(s) {
-        table.resize(size, nullptr);
-    }
+void waitForBackgroundThreads() {
+    shuttingDown = true;
+    unique_lock<mutex> guard(backgroundLock);
+    backgroundDone.wait(guard, []() { return backgroundThreads == 0; });
+}
 
-    ~ChainingHashMap() {
-        clear();
+// Classify button latency and hit counts for each map, printed at exit
+ClassifierStats chainStats;
+ClassifierStats openStats;
+ClassifierStats compiledStats;
+
+void print_stats(ostream& out) {
+    shared_ptr<ModelSnapshot> model = atomic_load(&currentModel);
+    printTableStats(out, "Chaining", model->chainMap.getStats());
+    printTableStats(out, "Open Addressing", model->openMap.getStats());
+    if (model->compiledModel.isOpen()) {
+        printTableStats(out, "Compiled Model", model->compiledModel.getStats());
     }
+    chainStats.print(out, "Chaining classifier");
+    openStats.print(out, "Open Addressing classifier");
+    compiledStats.print(out, "Compiled Model classifier");
+}
 
-    void insert(WordFreq data) override {
-        int index = hash(data.word);
-        Node* newNode = new Node(data);
-
-        if (!table[index]) {
-            table[index] = newNode;
-            count++;
-            return;
-        }
-
-        Node* current = table[index];
-        while (current->next) {
-            if (current->data.word == data.word) {
-                current->data = data;
-                delete newNode;
-                return;
-            }
-            current = current->next;
-        }
-
-        if (current->data.word == data.word) {
-            current->data = data;
-            delete newNode;
-            return;
-        }
-
-        current->next = newNode;
-        count++;
-    }
+void applyFeedback(ModelSnapshot& snapshot, const FeedbackWord& feedback) {
+    applyFeedback(&snapshot.chainMap, feedback);
+    applyFeedback(&snapshot.openMap, feedback);
+}
 
-    WordFreq* search(string key) override {
-        int index = hash(key);
-        Node* current = table[index];
+shared_ptr<ModelSnapshot> buildModelSnapshot(const string& filename) {
+    shared_ptr<ModelSnapshot> snapshot = make_shared<ModelSnapshot>();
 
-        while (current) {
-            if (current->data.word == key) {
-                return &(current->data);
-            }
-            current = current->next;
-        }
+    if (!loadWordFrequenciesFromTransposedCSV(filename, &snapshot->chainMap) ||
+        !loadWordFrequenciesFromTransposedCSV(filename, &snapshot->openMap)) {
         return nullptr;
     }
-
-    void clear() override {
-        for (Node* head : table) {
-            while (head) {
-                Node* temp = head;
-                head = head->next;
-                delete temp;
-            }
-        }
-        table.clear();
-        count = 0;
-    }
-};
-
-
-class OpenAddressingHashMap : public HashMap {
-private:
-    vector<pair<bool, WordFreq>> table;
-
-public:
-    OpenAddressingHashMap(int s = 997) : HashMap(s) {
-        table.resize(size, {false, WordFreq()});
-    }
-
-    void insert(WordFreq data) override {
-        int index = hash(data.word);
-        int i = 0;
-
-        while (i < size) {
-            int currentIndex = (index + i) % size;
-
-            if (!table[currentIndex].first) {
-                table[currentIndex] = {true, data};
-                count++;
-                return;
-            }
-            else if (table[currentIndex].second.word == data.word) {
-                table[currentIndex].second = data;
-                return;
-            }
-            i++;
-        }
-        cout << "Hash table is full!" << endl;
-    }
-
-    WordFreq* search(string key) override {
-        int index = hash(key);
-        int i = 0;
-
-        while (i < size) {
-            int currentIndex = (index + i) % size;
-
-            if (!table[currentIndex].first) {
-                return nullptr;
-            }
-            if (table[currentIndex].second.word == key) {
-                return &(table[currentIndex].second);
-            }
-            i++;
-        }
-        return nullptr;
+    feedbackLog.replay([&](string_view word, uint32_t spamCount, uint32_t hamCount) {
+        FeedbackWord feedback = {string(word), spamCount, hamCount};
+        applyFeedback(*snapshot, feedback);
+    });
+    if (ifstream(COMPILED_MODEL_FILE).good()) {
+        snapshot->compiledModel.open(COMPILED_MODEL_FILE);
     }
+    return snapshot;
+}
 
-    void clear() override {
-        table.clear();
-        table.resize(size, {false, WordFreq()});
-        count = 0;
+// Rebuilds the model on a background thread and swaps it in once it is
+// ready. Requests that arrive while a reload is running are folded into one
+// more pass, which also replays any feedback logged after this pass read it.
+void requestModelReload() {
+    reloadPending = true;
+    if (reloadRunning.exchange(true)) {
+        return;
     }
-};
 
-
-class EmailClassifier {
-private:
-    HashMap* wordMap;
-    double threshold;
-
-public:
-    EmailClassifier(HashMap* map, double thresh = 0.7)
-        : wordMap(map), threshold(thresh) {}
-
-    bool classify(const vector<string>& emailWords) {
-        double spamScore = 0.0;
-        double totalWords = 0.0;
-
-        for (const string& word : emailWords) {
-            WordFreq* wf = wordMap->search(word);
-            if (wf) {
-                double totalFreq = wf->spamFreq + wf->hamFreq;
-                if (totalFreq > 0) {
-                    spamScore += (wf->spamFreq / totalFreq);
-                    totalWords += 1.0;
+    startBackgroundThread([]() {
+        do {
+            while (reloadPending.exchange(false) && !shuttingDown) {
+                shared_ptr<ModelSnapshot> snapshot = buildModelSnapshot(MODEL_FILE);
+                if (snapshot) {
+                    atomic_store(&currentModel, snapshot);
+                }
+                else {
+                    cerr << "Model reload failed, keeping the previous model" << endl;
                 }
             }
-        }
-
-        return (totalWords > 0 && (spamScore / totalWords) >= threshold);
-    }
-};
-
-vector<string> splitCSVLine(const string& line) {
-    vector<string> tokens;
-    stringstream ss(line);
-    string token;
-
-    while (getline(ss, token, ',')) {
-        if (!token.empty() && token.front() == '"' && token.back() == '"') {
-            token = token.substr(1, token.length() - 2);
-        }
-        tokens.push_back(token);
-    }
-    return tokens;
+            reloadRunning = false;
+        } while (reloadPending && !shuttingDown && !reloadRunning.exchange(true));
+    });
 }
 
-void loadWordFrequenciesFromTransposedCSV(const string& filename, HashMap* wordMap) {
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Error opening file: " << filename << endl;
-        return;
+void on_model_file_changed(GFileMonitor* monitor, GFile* file, GFile* otherFile,
+                           GFileMonitorEvent event, gpointer user_data) {
+    if (event == G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT || event == G_FILE_MONITOR_EVENT_CREATED) {
+        requestModelReload();
     }
+}
 
-    string wordsLine, spamLine, hamLine;
-    getline(file, wordsLine);
-    getline(file, spamLine);
-    getline(file, hamLine);
-
-    vector<string> words = splitCSVLine(wordsLine);
-    vector<string> spamCounts = splitCSVLine(spamLine);
-    vector<string> hamCounts = splitCSVLine(hamLine);
-
-   
-    size_t expectedSize = words.size();
 
-    
-    if (spamCounts.size() != expectedSize || hamCounts.size() != expectedSize) {
-        cerr << "Error: Inconsistent number of columns in CSV file" << endl;
+// Folds the feedback log into one record per word on a background thread,
+// so replaying it on reload stays cheap however many emails were reported
+void requestFeedbackCompaction() {
+    if (!feedbackLog.needsCompaction() || compactionRunning.exchange(true)) {
         return;
     }
-
-    for (size_t i = 0; i < words.size(); ++i) {
-        if (words[i].empty() || words[i] == "Word" || words[i] == "word") {
-            continue;
-        }
-
-        try {
-            double spamFreq = stod(spamCounts[i]);
-            double hamFreq = stod(hamCounts[i]);
-
-            WordFreq wordFreq(words[i], spamFreq, hamFreq);
-            wordMap->insert(wordFreq);
-        } catch (const exception& e) {
-            cerr << "Error processing column " << i + 1 << ": " << words[i] << endl;
-            continue;
+    // Not stopped on shutdown: the compacted log is only renamed into place
+    // once it is complete, and main waits for that
+    startBackgroundThread([]() {
+        if (!feedbackLog.compact()) {
+            cerr << "Feedback log compaction failed, the log is unchanged" << endl;
         }
-    }
-
-    file.close();
+        compactionRunning = false;
+    });
 }
 
+// Runs on the main thread; everything after copying the text is left to workers
+string get_text_view_text(GtkWidget* emailTextView) {
+    GtkTextBuffer* textBuffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(emailTextView));
+    GtkTextIter startIter, endIter;
+    gtk_text_buffer_get_start_iter(textBuffer, &startIter);
+    gtk_text_buffer_get_end_iter(textBuffer, &endIter);
+    gchar* emailText = gtk_text_buffer_get_text(textBuffer, &startIter, &endIter, FALSE);
+    string text(emailText);
+    g_free(emailText);
+    return text;
+}
 
-void saveWordsToCSV(const vector<string>& emailWords, const string& filename) {
-    fstream file(filename, ios::in | ios::out | ios::app); 
+// Reports are logged on a worker thread, so the window never waits for
+// tokenizing or for the log's lock, which a compaction can hold. Unlike
+// classify requests none is dropped: the worker logs every report queued,
+// including those still waiting when the window is closed.
+struct FeedbackReport {
+    string text;
+    bool spam;
+};
 
-    if (!file.is_open()) {
-        cerr << "Error opening file for saving words: " << filename << endl;
+mutex feedbackQueueLock;                    //guards the two below
+vector<FeedbackReport> pendingFeedback;
+bool feedbackRunning = false;
+
+// Runs on the worker. Logs the email as spam or not spam. The live model is
+// not touched; a new snapshot that replays the log replaces it.
+void report_email(FeedbackReport& report) {
+    vector<string_view> emailWords;
+    tokenizeInPlace(report.text, emailWords);
+    vector<FeedbackWord> feedback = countFeedbackWords(emailWords, report.spam);
+    if (feedback.empty()) {
         return;
     }
 
-   
-    file.seekp(0, ios::end);
-    if (file.tellp() > 0) {
-        file.seekp(-1, ios::cur);  
-        char lastChar;
-        file.get(lastChar);
-
-       
-        if (lastChar != '\n') {
-            file << ",";
-        }
+    if (feedbackLog.append(feedback) == 0) {
+        return;
     }
+    requestModelReload();
+    requestFeedbackCompaction();
+}
 
-    
-    for (size_t i = 0; i < emailWords.size(); ++i) {
-        file << "\"" << emailWords[i] << "\""; 
-
-        
-        if (i != emailWords.size() - 1) {
-            file << ",";
-        }
+void requestFeedback(string text, bool spam) {
+    lock_guard<mutex> guard(feedbackQueueLock);
+    pendingFeedback.push_back({std::move(text), spam});
+    if (feedbackRunning) {
+        return;
     }
+    feedbackRunning = true;
+
+    startBackgroundThread([]() {
+        while (true) {
+            vector<FeedbackReport> reports;
+            {
+                lock_guard<mutex> guard(feedbackQueueLock);
+                if (pendingFeedback.empty()) {
+                    feedbackRunning = false;
+                    return;
+                }
+                reports.swap(pendingFeedback);
+            }
+            for (FeedbackReport& report : reports) {
+                report_email(report);
+            }
+        }
+    });
+}
 
-    file << endl; 
-    file.close();
+void on_spam_button_clicked(GtkButton *button, gpointer user_data) {
+    requestFeedback(get_text_view_text(GTK_WIDGET(user_data)), true);
 }
 
+void on_ham_button_clicked(GtkButton *button, gpointer user_data) {
+    requestFeedback(get_text_view_text(GTK_WIDGET(user_data)), false);
+}
 
 
-void show_result_window(const char* chainingResult, const char* openResult) {
+void show_result_window(const char* chainingResult, const char* openResult, const char* compiledResult) {
     
     GtkWidget* resultWindow = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(resultWindow), "Classification Result");
@@ -320,6 +243,11 @@ void show_result_window(const char* chainingResult, const char* openResult) {
     gtk_box_pack_start(GTK_BOX(resultBox), chainingLabel, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(resultBox), openLabel, FALSE, FALSE, 0);
 
+    if (compiledResult) {
+        GtkWidget* compiledLabel = gtk_label_new(compiledResult);
+        gtk_box_pack_start(GTK_BOX(resultBox), compiledLabel, FALSE, FALSE, 0);
+    }
+
   
     gtk_container_add(GTK_CONTAINER(resultWindow), resultBox);
 
@@ -328,65 +256,131 @@ void show_result_window(const char* chainingResult, const char* openResult) {
 }
 
 
-void on_classify_button_clicked(GtkButton *button, gpointer user_data) {
-    GtkWidget* emailTextView = GTK_WIDGET(user_data);  
-    
-    GtkTextBuffer* textBuffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(emailTextView));
-
-   
-    GtkTextIter startIter, endIter;
-
-  
-    gtk_text_buffer_get_start_iter(textBuffer, &startIter);
+// Classification runs on a worker thread so that a large email cannot freeze
+// the window. Only the newest click matters: a click while the worker is busy
+// replaces the request still waiting, and the result of a request that has
+// been overtaken is dropped instead of shown.
+struct ClassifyRequest {
+    uint64_t generation;
+    string text;
+};
 
-    gtk_text_buffer_get_end_iter(textBuffer, &endIter);
+struct ClassifyResult {
+    uint64_t generation;
+    const char* chainingResult;
+    const char* openResult;
+    const char* compiledResult;       //nullptr without a compiled model
+};
 
-    
-    gchar* emailText = gtk_text_buffer_get_text(textBuffer, &startIter, &endIter, FALSE);
+atomic<uint64_t> classifyGeneration(0);     //generation of the newest request
+mutex classifyLock;                         //guards the two below
+unique_ptr<ClassifyRequest> pendingClassification;
+bool classifyRunning = false;
+
+// Runs on the worker. The Chaining and Open Addressing maps are scored on
+// two threads at once.
+ClassifyResult* classify_email(ClassifyRequest& request) {
+    vector<string_view> emailWords;
+    tokenizeInPlace(request.text, emailWords);
+    if (request.generation != classifyGeneration) {
+        return nullptr;
+    }
 
-    
-    ChainingHashMap chainMap(2000);
-    OpenAddressingHashMap openMap(2000);
+    // Hold on to the current snapshot so a reload cannot free it mid-classification
+    shared_ptr<ModelSnapshot> model = atomic_load(&currentModel);
 
-   
-    loadWordFrequenciesFromTransposedCSV("C:\\Users\\Komal yadav\\major_dsa\\test.csv", &chainMap);
-    loadWordFrequenciesFromTransposedCSV("C:\\Users\\Komal yadav\\major_dsa\\test.csv", &openMap);
+    bool isSpamOpen = false;
+    thread openThread([&]() {
+        EmailClassifier openClassifier(&model->openMap, 0);
+        openClassifier.setStats(&openStats);
+        isSpamOpen = openClassifier.classify(emailWords);
+    });
 
-    EmailClassifier chainClassifier(&chainMap, 0);
-    EmailClassifier openClassifier(&openMap, 0);
-
-    vector<string> emailWords;
+    EmailClassifier chainClassifier(&model->chainMap, 0);
+    chainClassifier.setStats(&chainStats);
+    bool isSpamChain = chainClassifier.classify(emailWords);
 
-   
-    stringstream ss(emailText);
-    string word;
-    while (ss >> word) {
-        emailWords.push_back(word);
+    ClassifyResult* result = new ClassifyResult();
+    result->generation = request.generation;
+    result->compiledResult = nullptr;
+    if (model->compiledModel.isOpen()) {
+        EmailClassifier compiledClassifier(&model->compiledModel, 0);
+        compiledClassifier.setStats(&compiledStats);
+        result->compiledResult = compiledClassifier.classify(emailWords) ? "Compiled Model: Spam" : "Compiled Model: Not Spam";
     }
+    openThread.join();
 
-   
-    saveWordsToCSV(emailWords, "C:\\Users\\Komal yadav\\major_dsa\\test.csv");
+    result->chainingResult = isSpamChain ? "Chaining: Spam" : "Chaining: Not Spam";
+    result->openResult = isSpamOpen ? "Open Addressing: Spam" : "Open Addressing: Not Spam";
+    return result;
+}
 
-   
-    bool isSpamChain = chainClassifier.classify(emailWords);
-    bool isSpamOpen = openClassifier.classify(emailWords);
+// Runs on the main thread
+gboolean show_classification_result(gpointer data) {
+    unique_ptr<ClassifyResult> result((ClassifyResult*)data);
+    if (result->generation == classifyGeneration) {
+        show_result_window(result->chainingResult, result->openResult, result->compiledResult);
+    }
+    return G_SOURCE_REMOVE;
+}
 
-   
-    const char* chainingResult = isSpamChain ? "Chaining: Spam" : "Chaining: Not Spam";
-    const char* openResult = isSpamOpen ? "Open Addressing: Spam" : "Open Addressing: Not Spam";
+void requestClassification(string text) {
+    unique_ptr<ClassifyRequest> request(new ClassifyRequest());
+    request->generation = ++classifyGeneration;
+    request->text = std::move(text);
 
-    // Show result window
-    show_result_window(chainingResult, openResult);
+    lock_guard<mutex> guard(classifyLock);
+    pendingClassification = std::move(request);
+    if (classifyRunning) {
+        return;
+    }
+    classifyRunning = true;
+
+    startBackgroundThread([]() {
+        while (true) {
+            unique_ptr<ClassifyRequest> next;
+            {
+                lock_guard<mutex> guard(classifyLock);
+                if (!pendingClassification || shuttingDown) {
+                    classifyRunning = false;
+                    return;
+                }
+                next = std::move(pendingClassification);
+            }
+            // No main loop runs the idle callback once shutdown has begun
+            unique_ptr<ClassifyResult> result(classify_email(*next));
+            if (result && !shuttingDown) {
+                g_idle_add(show_classification_result, result.release());
+            }
+        }
+    });
+}
 
-    g_free(emailText);  
+void on_classify_button_clicked(GtkButton *button, gpointer user_data) {
+    requestClassification(get_text_view_text(GTK_WIDGET(user_data)));
 }
 
 int main(int argc, char *argv[]) {
     gtk_init(&argc, &argv); 
 
+    feedbackLog.open(FEEDBACK_LOG_FILE);
+
+    shared_ptr<ModelSnapshot> initialModel = buildModelSnapshot(MODEL_FILE);
+    if (!initialModel) {
+        initialModel = make_shared<ModelSnapshot>();
+    }
+    atomic_store(&currentModel, initialModel);
+
+    GFile* modelFile = g_file_new_for_path(MODEL_FILE.c_str());
+    GFileMonitor* modelMonitor = g_file_monitor_file(modelFile, G_FILE_MONITOR_NONE, NULL, NULL);
+    if (modelMonitor) {
+        g_signal_connect(modelMonitor, "changed", G_CALLBACK(on_model_file_changed), NULL);
+    }
+
     
     GtkWidget* window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(window), "Email Classification");
+    g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
 
 
     gtk_window_set_default_size(GTK_WINDOW(window), 800, 600); 
@@ -399,15 +393,33 @@ int main(int argc, char *argv[]) {
 
     g_signal_connect(classifyButton, "clicked", G_CALLBACK(on_classify_button_clicked), emailTextView);
 
+    GtkWidget* spamButton = gtk_button_new_with_label("Mark as Spam");
+    GtkWidget* hamButton = gtk_button_new_with_label("Mark as Not Spam");
+    g_signal_connect(spamButton, "clicked", G_CALLBACK(on_spam_button_clicked), emailTextView);
+    g_signal_connect(hamButton, "clicked", G_CALLBACK(on_ham_button_clicked), emailTextView);
+    GtkWidget* feedbackBox = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+    gtk_box_pack_start(GTK_BOX(feedbackBox), spamButton, TRUE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(feedbackBox), hamButton, TRUE, TRUE, 0);
+
    
     GtkWidget* box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
     gtk_box_pack_start(GTK_BOX(box), emailTextView, TRUE, TRUE, 0);
     gtk_box_pack_start(GTK_BOX(box), classifyButton, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(box), feedbackBox, FALSE, FALSE, 0);
 
     gtk_container_add(GTK_CONTAINER(window), box);
     gtk_widget_show_all(window);
 
     gtk_main();
 
+    // The stats and the current model must not change while they are printed
+    waitForBackgroundThreads();
+    print_stats(cout);
+
+    if (modelMonitor) {
+        g_object_unref(modelMonitor);
+    }
+    g_object_unref(modelFile);
+
     return 0;
 }
@@ -0,0 +1,21 @@
+#include "compiledmodel.h"
+
+// Model compiler: turns the transposed frequency CSV into the binary image
+// that CompiledModel maps.
+//   modelc [input.csv] [output.model]
+int main(int argc, char *argv[]) {
+    string csvFile = argc > 1 ? argv[1] : "final.csv";
+    string modelFile = argc > 2 ? argv[2] : "final.model";
+
+    if (!compileModel(csvFile, modelFile)) {
+        cerr << "Failed to compile " << csvFile << endl;
+        return 1;
+    }
+
+    CompiledModel model;
+    if (!model.open(modelFile)) {
+        return 1;
+    }
+    cout << "Compiled " << model.getCount() << " words from " << csvFile << " into " << modelFile << endl;
+    return 0;
+}
@@ -0,0 +1,343 @@
+#ifndef PERFECTHASH_H
+#define PERFECTHASH_H
+
+#include "hashmap.h"
+#include <algorithm>
+#include <unordered_map>
+
+// Read-only map for a vocabulary that is loaded once and then only read. It
+// builds a minimal perfect hash over the words, in the style of PTHash:
+//  - every word falls into one of about n / KEYS_PER_BUCKET buckets, and each
+//    bucket stores a 16-bit pilot chosen at build time so that its words land
+//    on table positions no other word uses;
+//  - positions run a little past n (the table is LOAD_PERCENT full) so the
+//    last buckets still find room quickly, and the few words placed past n
+//    are remapped into the holes below n.
+// A lookup reads one pilot, computes the slot (plus a remap entry for about
+// 1% of words) and compares one key; there is no collision resolution. The
+// index costs about 3 bits per word: 16 / KEYS_PER_BUCKET for the pilots and
+// 32 * (100 / LOAD_PERCENT - 1) for the remap table.
+//
+// A word that is already indexed is updated in place. New words are staged
+// and found through a side table until finishRehash() folds them all into
+// the index with one rebuild (the CSV loader calls it after the last word),
+// so adding words one at a time between lookups never rebuilds per word.
+// search() never rebuilds, but a staged word costs every miss a lookup in the
+// side table, so call finishRehash() before reading from several threads.
+class PerfectHashMap final : public HashMap {
+private:
+    enum { KEYS_PER_BUCKET = 6, LOAD_PERCENT = 99, MAX_PILOT = 0xffff };
+    static constexpr uint64_t DENSE_KEYS_BOUND = 0x99999999ULL;    //60% of 2^32
+
+    vector<WordFreq> slots;             //exactly one per word, in slot order
+    vector<uint16_t> pilots;            //one per bucket
+    vector<uint32_t> remap;             //slot for positions >= slots.size()
+    vector<WordFreq> collisions;        //words whose full 64-bit hash another word already has
+    vector<uint64_t> sharedHashSlots;   //bit per slot whose word's hash a collision has; empty without collisions
+    uint64_t seed;
+    uint64_t positions;
+    uint64_t bucketCount;
+    uint64_t denseBuckets;
+
+    vector<WordFreq> pending;           //new words not in the index yet
+    unordered_map<string, size_t> pendingIndex;
+
+    uint64_t keyHash(uint64_t hashVal) const {
+        return multiplyFold64(hashVal ^ seed, 0x9e3779b97f4a7c15ULL);
+    }
+
+    // Skewed like PTHash's buckets: 60% of the words go to the first 30% of
+    // buckets. Those dense buckets are placed while the table is still empty,
+    // which leaves small buckets for the end, when free slots are scarce.
+    uint64_t bucketOf(uint64_t key) const {
+        uint64_t low = key & 0xffffffffULL;
+        if ((key >> 32) < DENSE_KEYS_BOUND) {
+            return (low * denseBuckets) >> 32;
+        }
+        return denseBuckets + ((low * (bucketCount - denseBuckets)) >> 32);
+    }
+
+    uint64_t positionOf(uint64_t key, uint64_t pilot) const {
+        uint64_t mixed = multiplyFold64(key ^ (pilot * 0xc2b2ae3d27d4eb4fULL + 1), 0x165667b19e3779f9ULL);
+        return ((mixed & 0xffffffffULL) * positions) >> 32;
+    }
+
+    size_t slotFor(uint64_t hashVal) const {
+        uint64_t key = keyHash(hashVal);
+        uint64_t position = positionOf(key, pilots[bucketOf(key)]);
+        return position < slots.size() ? (size_t)position : remap[position - slots.size()];
+    }
+
+    // Places every key, or returns false if some bucket finds no pilot
+    bool place(const vector<uint64_t>& keys, int loadPercent, vector<uint32_t>& slotOfKey) {
+        size_t n = keys.size();
+        positions = max<uint64_t>(n, (n * 100 + loadPercent - 1) / loadPercent);
+        bucketCount = max<uint64_t>(1, (n + KEYS_PER_BUCKET - 1) / KEYS_PER_BUCKET);
+        denseBuckets = bucketCount * 3 / 10;
+
+        // Keys grouped by bucket, then buckets ordered largest first: big
+        // buckets are the hardest to place, so they go while the table is empty
+        vector<uint32_t> bucketStart(bucketCount + 1, 0);
+        for (uint64_t key : keys) {
+            bucketStart[bucketOf(key) + 1]++;
+        }
+        size_t largest = 0;
+        for (uint64_t b = 0; b < bucketCount; b++) {
+            largest = max<size_t>(largest, bucketStart[b + 1]);
+            bucketStart[b + 1] += bucketStart[b];
+        }
+        vector<uint32_t> keysByBucket(n);
+        vector<uint32_t> fill(bucketStart.begin(), bucketStart.end() - 1);
+        for (size_t i = 0; i < n; i++) {
+            keysByBucket[fill[bucketOf(keys[i])]++] = (uint32_t)i;
+        }
+        vector<vector<uint32_t>> bucketsBySize(largest + 1);
+        for (uint64_t b = 0; b < bucketCount; b++) {
+            bucketsBySize[bucketStart[b + 1] - bucketStart[b]].push_back((uint32_t)b);
+        }
+
+        // Positions are marked taken as a bucket's words are tried, so two
+        // words of one bucket cannot share a slot either; a failed pilot
+        // clears its marks again
+        vector<uint64_t> taken((positions + 63) / 64, 0);
+        vector<uint64_t> bucketKeys(largest), trial(largest);
+        vector<uint64_t> positionOfKey(n);
+        pilots.assign(bucketCount, 0);
+        for (size_t bucketSize = largest; bucketSize > 0; bucketSize--) {
+            for (uint32_t b : bucketsBySize[bucketSize]) {
+                const uint32_t* members = &keysByBucket[bucketStart[b]];
+                for (size_t m = 0; m < bucketSize; m++) {
+                    bucketKeys[m] = keys[members[m]];
+                }
+                bool placed = false;
+                for (uint64_t pilot = 0; pilot <= MAX_PILOT && !placed; pilot++) {
+                    size_t m = 0;
+                    for (; m < bucketSize; m++) {
+                        uint64_t position = positionOf(bucketKeys[m], pilot);
+                        uint64_t bit = 1ULL << (position % 64);
+                        if (taken[position / 64] & bit) {
+                            break;
+                        }
+                        taken[position / 64] |= bit;
+                        trial[m] = position;
+                    }
+                    placed = m == bucketSize;
+                    if (placed) {
+                        pilots[b] = (uint16_t)pilot;
+                        for (m = 0; m < bucketSize; m++) {
+                            positionOfKey[members[m]] = trial[m];
+                        }
+                    }
+                    else {
+                        while (m > 0) {
+                            m--;
+                            taken[trial[m] / 64] &= ~(1ULL << (trial[m] % 64));
+                        }
+                    }
+                }
+                if (!placed) {
+                    return false;
+                }
+            }
+        }
+
+        // Positions past n move into the holes below n, in order
+        vector<uint32_t> holes;
+        for (size_t p = 0; p < n; p++) {
+            if (!(taken[p / 64] >> (p % 64) & 1)) {
+                holes.push_back((uint32_t)p);
+            }
+        }
+        remap.assign(positions - n, 0);
+        size_t nextHole = 0;
+        for (uint64_t p = n; p < positions; p++) {
+            if (taken[p / 64] >> (p % 64) & 1) {
+                remap[p - n] = holes[nextHole++];
+            }
+        }
+        slotOfKey.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            uint64_t p = positionOfKey[i];
+            slotOfKey[i] = p < n ? (uint32_t)p : remap[p - n];
+        }
+        return true;
+    }
+
+    void build(vector<WordFreq>& words) {
+        slots.clear();
+        collisions.clear();
+        sharedHashSlots.clear();
+
+        // No pilot can separate two words with the same 64-bit hash; the
+        // second one is kept aside and only checked when its slot mismatches
+        vector<pair<uint64_t, uint32_t>> hashed(words.size());
+        for (size_t i = 0; i < words.size(); i++) {
+            hashed[i] = make_pair(hashCode(words[i].word), (uint32_t)i);
+        }
+        sort(hashed.begin(), hashed.end());
+        vector<uint64_t> hashes, sharedHashes;
+        vector<uint32_t> wordOfKey;
+        for (size_t i = 0; i < hashed.size(); i++) {
+            if (i > 0 && hashed[i].first == hashed[i - 1].first) {
+                collisions.push_back(std::move(words[hashed[i].second]));
+                sharedHashes.push_back(hashed[i].first);
+            }
+            else {
+                hashes.push_back(hashed[i].first);
+                wordOfKey.push_back(hashed[i].second);
+            }
+        }
+
+        // A failed attempt retries with another seed and a slightly emptier table
+        vector<uint64_t> keys(hashes.size());
+        vector<uint32_t> slotOfKey;
+        for (int attempt = 0;; attempt++) {
+            seed = multiplyFold64(0x2545f4914f6cdd1dULL + attempt, 0x9e3779b97f4a7c15ULL);
+            for (size_t i = 0; i < hashes.size(); i++) {
+                keys[i] = keyHash(hashes[i]);
+            }
+            if (place(keys, max(50, LOAD_PERCENT - attempt), slotOfKey)) {
+                break;
+            }
+        }
+
+        slots.resize(keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            slots[slotOfKey[i]] = std::move(words[wordOfKey[i]]);
+        }
+        // A word with a shared hash lands on the slot of the first word with it
+        if (!sharedHashes.empty()) {
+            sharedHashSlots.assign((slots.size() + 63) / 64, 0);
+            for (uint64_t hashVal : sharedHashes) {
+                size_t slot = slotFor(hashVal);
+                sharedHashSlots[slot / 64] |= 1ULL << (slot % 64);
+            }
+        }
+        size = max<int>(1, (int)slots.size());
+    }
+
+    // Builds the index again over the indexed words and the staged ones
+    void rebuild() {
+        vector<WordFreq> words = std::move(slots);
+        for (WordFreq& wf : collisions) {
+            words.push_back(std::move(wf));
+        }
+        for (WordFreq& wf : pending) {
+            words.push_back(std::move(wf));
+        }
+        pending.clear();
+        pendingIndex.clear();
+        build(words);
+    }
+
+    // The indexed word for key, or nullptr
+    WordFreq* searchIndex(string_view key, uint64_t hashVal) {
+        if (slots.empty()) {
+            return nullptr;
+        }
+        size_t slotIndex = slotFor(hashVal);
+        WordFreq& slot = slots[slotIndex];
+        if (slot.word == key) {
+            return &slot;
+        }
+        // Only a key landing on a slot whose hash is shared can be a collision
+        if (!sharedHashSlots.empty() && (sharedHashSlots[slotIndex / 64] >> (slotIndex % 64) & 1)) {
+            for (WordFreq& wf : collisions) {
+                if (wf.word == key) {
+                    return &wf;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+public:
+    // s is only a hint for how many words will be inserted
+    PerfectHashMap(int s = 997, HashFunction h = wordHash64)
+        : HashMap(1, h), seed(0), positions(0), bucketCount(0), denseBuckets(0) {
+        pending.reserve(s);
+    }
+
+    void insert(WordFreq data) override {
+        WordFreq* existing = searchIndex(data.word, hashCode(data.word));
+        if (existing) {
+            *existing = data;
+            return;
+        }
+        auto found = pendingIndex.find(data.word);
+        if (found != pendingIndex.end()) {
+            pending[found->second] = data;
+            return;
+        }
+        pendingIndex.emplace(data.word, pending.size());
+        pending.push_back(data);
+        count++;
+    }
+
+    WordFreq* search(string_view key) override {
+        return searchHashed(key, hashCode(key));
+    }
+
+    // The slot depends on the bucket's pilot, so the pilot comes first
+    void prefetch(uint64_t hashVal) override {
+        if (!slots.empty()) {
+            prefetchAddress(&pilots[bucketOf(keyHash(hashVal))]);
+        }
+    }
+
+    void prefetchEntry(uint64_t hashVal) override {
+        if (!slots.empty()) {
+            prefetchAddress(&slots[slotFor(hashVal)]);
+        }
+    }
+
+    WordFreq* searchHashed(string_view key, uint64_t hashVal) override {
+        WordFreq* wf = searchIndex(key, hashVal);
+        if (wf || pending.empty()) {
+            return wf;
+        }
+        auto found = pendingIndex.find(string(key));
+        return found != pendingIndex.end() ? &pending[found->second] : nullptr;
+    }
+
+    void finishRehash() override {
+        if (!pending.empty()) {
+            rebuild();
+        }
+    }
+
+    TableStats getStats() override {
+        finishRehash();
+        TableStats stats;
+        stats.buckets = slots.size() + collisions.size();
+        stats.words = stats.buckets;
+        stats.usedBuckets = stats.buckets;
+        if (!slots.empty()) {
+            stats.probeLengths.assign(2, 0);
+            stats.probeLengths[1] = slots.size();
+        }
+        for (size_t i = 0; i < collisions.size(); i++) {
+            addToHistogram(stats.probeLengths, i + 2);
+        }
+        return stats;
+    }
+
+    // Bits of pilot and remap table per word
+    double getIndexBitsPerKey() const {
+        return slots.empty() ? 0.0 : (pilots.size() * 16.0 + remap.size() * 32.0) / slots.size();
+    }
+
+    void clear() override {
+        slots.clear();
+        pilots.clear();
+        remap.clear();
+        collisions.clear();
+        sharedHashSlots.clear();
+        pending.clear();
+        pendingIndex.clear();
+        size = 1;
+        count = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef QUANTIZEDMODEL_H
+#define QUANTIZEDMODEL_H
+
+#include "hashmap.h"
+#include <cstring>
+
+// Scores are stored in 1/65280ths. 65280 is 255 * 256, so an 8-bit score is
+// the same code with the low byte zero and both precisions share one decoder.
+enum { QUANTIZED_SCORE_SCALE = 65280, QUANTIZED_NO_SCORE = 0xffff };
+
+// One word of a QuantizedModel: 8 bytes instead of a 56-byte WordFreq. Only
+// the spam score is kept, which is all the classifier reads; the counts are
+// dropped.
+struct QuantizedEntry {
+    uint32_t keyOffset;         //into the string pool
+    uint16_t keyLength;
+    uint16_t score;             //QUANTIZED_NO_SCORE for a word with no score
+
+    float getSpamScore() const {
+        return score == QUANTIZED_NO_SCORE ? NO_SPAM_SCORE : score * (1.0f / QUANTIZED_SCORE_SCALE);
+    }
+};
+
+// Compact model that stays in cache. Keys live back to back in one string
+// pool and entries refer to them by 32-bit offset, the way the compiled
+// model lays them out, and each score is rounded to 16 or 8 bits. Slots are
+// found as in FlatHashMap: one control byte per slot, matched 16 at a time,
+// so a miss usually reads one group of control bytes and no entry. For
+// final.csv the control bytes, entries and pool come to about 27 KB, which
+// fits in L1, against about 115 KB of FlatHashMap slots plus the heap blocks
+// of long words.
+//
+// Rounding moves a word's score by at most half a step (1/130560 with 16
+// bits, 1/510 with 8), and so an email's average by no more; an email whose
+// average is that close to the threshold can change verdict.
+// measureAccuracy in scoring.h reports what this costs on a labelled corpus.
+class QuantizedModel {
+private:
+    enum { GROUP_WIDTH = 16, EMPTY = -128 };
+
+    vector<int8_t> ctrl;                //EMPTY, or the low 7 bits of the key's hash
+    vector<QuantizedEntry> slots;
+    string pool;
+    uint32_t mask;
+    int count;
+    int scoreBits;
+
+    uint16_t quantize(float score) const {
+        if (score < 0) {
+            return QUANTIZED_NO_SCORE;
+        }
+        score = min(score, 1.0f);
+        if (scoreBits == 8) {
+            return (uint16_t)(lround(score * 255.0) << 8);
+        }
+        return (uint16_t)lround(score * (double)QUANTIZED_SCORE_SCALE);
+    }
+
+    uint32_t homeGroup(uint64_t hashVal) const {
+        return (uint32_t)(hashVal >> 7) & mask & ~(uint32_t)(GROUP_WIDTH - 1);
+    }
+
+    // Returns the slot holding key, or -1; probes like FlatHashMap::findSlot
+    int64_t findSlot(string_view key, uint64_t hashVal) const {
+        uint32_t group = homeGroup(hashVal);
+        int8_t fragment = (int8_t)(hashVal & 0x7f);
+
+        for (uint32_t step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+            uint32_t matches = matchControlGroup(&ctrl[group], fragment);
+            while (matches) {
+                uint32_t slot = group + lowestSetBit(matches);
+                const QuantizedEntry& entry = slots[slot];
+                if (entry.keyLength == key.size() && memcmp(pool.data() + entry.keyOffset, key.data(), key.size()) == 0) {
+                    return slot;
+                }
+                matches &= matches - 1;
+            }
+            if (matchControlGroup(&ctrl[group], EMPTY) || step >= slots.size()) {
+                return -1;
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    uint32_t findEmptySlot(uint64_t hashVal) const {
+        uint32_t group = homeGroup(hashVal);
+        for (uint32_t step = GROUP_WIDTH; ; step += GROUP_WIDTH) {
+            uint32_t empties = matchControlGroup(&ctrl[group], EMPTY);
+            if (empties) {
+                return group + lowestSetBit(empties);
+            }
+            group = (group + step) & mask;
+        }
+    }
+
+    void resize(size_t size) {
+        vector<int8_t> oldCtrl;
+        oldCtrl.swap(ctrl);
+        vector<QuantizedEntry> oldSlots;
+        oldSlots.swap(slots);
+
+        ctrl.assign(size, EMPTY);
+        slots.resize(size);
+        mask = (uint32_t)size - 1;
+
+        for (size_t i = 0; i < oldSlots.size(); i++) {
+            if (oldCtrl[i] != EMPTY) {
+                uint32_t slot = findEmptySlot(hashCode(getKey(oldSlots[i])));
+                ctrl[slot] = oldCtrl[i];
+                slots[slot] = oldSlots[i];
+            }
+        }
+    }
+
+public:
+    // s is the initial number of slots; bits is 16 or 8
+    QuantizedModel(int s = 997, int bits = 16) : mask(0), count(0), scoreBits(bits <= 8 ? 8 : 16) {
+        size_t size = GROUP_WIDTH;
+        while (size < (size_t)s) {
+            size *= 2;
+        }
+        resize(size);
+    }
+
+    void insert(WordFreq data) {
+        uint64_t hashVal = hashCode(data.word);
+        int64_t found = findSlot(data.word, hashVal);
+        if (found >= 0) {
+            slots[found].score = quantize(data.getSpamScore());
+            return;
+        }
+        if (data.word.size() > 0xffff || pool.size() + data.word.size() > 0xffffffffULL) {
+            cerr << "Error: cannot add \"" << data.word.substr(0, 32) << "\" to the quantized model" << endl;
+            return;
+        }
+
+        // Keep at least 1/8 of the slots empty so misses stop early
+        if ((size_t)(count + 1) * 8 > slots.size() * 7) {
+            resize(slots.size() * 2);
+        }
+        uint32_t slot = findEmptySlot(hashVal);
+        ctrl[slot] = (int8_t)(hashVal & 0x7f);
+        slots[slot].keyOffset = (uint32_t)pool.size();
+        slots[slot].keyLength = (uint16_t)data.word.size();
+        slots[slot].score = quantize(data.getSpamScore());
+        pool += data.word;
+        count++;
+    }
+
+    void finishRehash() {}
+
+    const QuantizedEntry* search(string_view key) const {
+        return searchHashed(key, hashCode(key));
+    }
+
+    uint64_t hashCode(string_view key) const {
+        return wordHash64(key);
+    }
+
+    void prefetch(uint64_t hashVal) const {
+        uint32_t group = homeGroup(hashVal);
+        prefetchAddress(&ctrl[group]);
+        prefetchAddress(&slots[group]);
+    }
+
+    // The key a matching entry points to in the pool
+    void prefetchEntry(uint64_t hashVal) const {
+        uint32_t group = homeGroup(hashVal);
+        uint32_t matches = matchControlGroup(&ctrl[group], (int8_t)(hashVal & 0x7f));
+        if (matches) {
+            prefetchAddress(pool.data() + slots[group + lowestSetBit(matches)].keyOffset);
+        }
+    }
+
+    const QuantizedEntry* searchHashed(string_view key, uint64_t hashVal) const {
+        int64_t slot = findSlot(key, hashVal);
+        return slot >= 0 ? &slots[slot] : nullptr;
+    }
+
+    string_view getKey(const QuantizedEntry& entry) const {
+        return string_view(pool.data() + entry.keyOffset, entry.keyLength);
+    }
+
+    int getCount() const { return count; }
+    int getScoreBits() const { return scoreBits; }
+
+    // Control bytes, entries and key bytes: everything a lookup can touch
+    size_t getBytes() const {
+        return ctrl.size() + slots.size() * sizeof(QuantizedEntry) + pool.size();
+    }
+
+    // Probes are counted in groups of GROUP_WIDTH slots, as findSlot visits them
+    TableStats getStats() const {
+        TableStats stats;
+        stats.buckets = slots.size();
+        for (uint32_t slot = 0; slot < slots.size(); slot++) {
+            if (ctrl[slot] == EMPTY) {
+                continue;
+            }
+            uint32_t group = homeGroup(hashCode(getKey(slots[slot])));
+            size_t probes = 1;
+            for (uint32_t step = GROUP_WIDTH; slot < group || slot >= group + GROUP_WIDTH; step += GROUP_WIDTH) {
+                group = (group + step) & mask;
+                probes++;
+            }
+            addToHistogram(stats.probeLengths, probes);
+            stats.words++;
+            stats.usedBuckets++;
+        }
+        return stats;
+    }
+
+    void clear() {
+        ctrl.assign(ctrl.size(), EMPTY);
+        pool.clear();
+        count = 0;
+    }
+};
+
+#endif
@@ -1,10 +1,12 @@
-#include "hashmap.h"
+#include "readCSV.h"
+#include "mappedfile.h"
+#include "threadpool.h"
+#include <charconv>
+#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
-typedef pair<string, vector<string>> EmailData;
-
 // Function to read the header (row of words present) and return the list of words
 vector<string> readHeader(const string &filename)
 {
@@ -37,9 +39,9 @@ vector<string> readHeader(const string &filename)
     return headerWords;
 }
 
-// Function to read the entire dataset and separate into spam and ham
-void readEntireDataset(const string &filename, const vector<string> &headerWords,
-                       vector<EmailData> &allSpam, vector<EmailData> &allHam)
+// The original getline / stoi reader, kept to check the fast one against
+void readEntireDatasetStream(const string &filename, const vector<string> &headerWords,
+                             vector<EmailData> &allSpam, vector<EmailData> &allHam)
 {
     ifstream file(filename);
     string line;
@@ -97,3 +99,401 @@ void readEntireDataset(const string &filename, const vector<string> &headerWords
 
     file.close();
 }
+
+// Parses an integer field, ignoring leading spaces and a trailing '\r'
+static bool parseField(const char *begin, const char *end, int &value)
+{
+    while (begin < end && *begin == ' ')
+        begin++;
+    return begin < end && from_chars(begin, end, value).ec == errc();
+}
+
+// Scans the rows in [begin, end), which must start at the beginning of a row
+// and end just after a newline (or at the end of the file). Every ',' or '\n'
+// ends a field: a field ended by ',' is a count for its column and the field
+// ended by '\n' is the label. For each row the sink gets count(column, n) for
+// every positive count of the first columnCount word columns, then either
+// endRow(label) or, if the row is malformed, dropRow(). Returns the number of
+// malformed rows.
+template <class Sink>
+static size_t scanRows(const char *begin, const char *end, size_t columnCount, Sink &sink)
+{
+    const char *fieldStart = begin;
+    size_t column = 0;
+    bool rowOk = true;
+    size_t badRows = 0;
+
+    auto endField = [&](const char *pos, bool endOfRow)
+    {
+        if (!endOfRow)
+        {
+            // Column 0 is "Email No."; columns past the header have no word
+            if (column > 0 && column <= columnCount)
+            {
+                int count = 0;
+                if (!parseField(fieldStart, pos, count))
+                    rowOk = false;
+                else if (count > 0)
+                    sink.count(column - 1, count);
+            }
+            column++;
+        }
+        else
+        {
+            int label = 0;
+            if (column == 0)
+            {
+                // Blank lines are skipped, lines with a single cell are malformed
+                if (pos > fieldStart && !(pos == fieldStart + 1 && *fieldStart == '\r'))
+                    badRows++;
+            }
+            else if (!rowOk || !parseField(fieldStart, pos, label))
+            {
+                sink.dropRow();
+                badRows++;
+            }
+            else
+            {
+                sink.endRow(label);
+            }
+            column = 0;
+            rowOk = true;
+        }
+        fieldStart = pos + 1;
+    };
+
+    const char *pos = begin;
+#ifdef HASHMAP_USE_SSE2
+    // 16 bytes at a time: one compare per delimiter gives a bit mask of field ends
+    const __m128i comma = _mm_set1_epi8(','), newline = _mm_set1_epi8('\n');
+    for (; pos + 16 <= end; pos += 16)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)pos);
+        uint32_t delimiters = (uint32_t)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, comma), _mm_cmpeq_epi8(bytes, newline)));
+        while (delimiters)
+        {
+            int bit = lowestSetBit(delimiters);
+            endField(pos + bit, pos[bit] == '\n');
+            delimiters &= delimiters - 1;
+        }
+    }
+#endif
+    for (; pos < end; pos++)
+    {
+        if (*pos == ',' || *pos == '\n')
+            endField(pos, *pos == '\n');
+    }
+
+    // Last row without a trailing newline
+    if (fieldStart < end || column > 0)
+        endField(end, true);
+    return badRows;
+}
+
+// Maps filename and splits the rows after the header into runs of about
+// 1 MB, each ending after a newline. Run r is [bounds[r], bounds[r + 1]).
+static bool mapRuns(const string &filename, MappedFile &file, vector<const char *> &bounds)
+{
+    bounds.clear();
+    if (!file.open(filename))
+        return false;
+
+    const char *data = file.data();
+    const char *end = data + file.size();
+
+    // Skipping the header line
+    const char *rowsStart = (const char *)memchr(data, '\n', file.size());
+    if (!rowsStart || rowsStart + 1 >= end)
+    {
+        bounds.push_back(end);
+        return true;
+    }
+    rowsStart++;
+
+    const size_t RUN_BYTES = 1 << 20;
+    bounds.push_back(rowsStart);
+    while (true)
+    {
+        const char *next = bounds.back() + RUN_BYTES;
+        if (next >= end)
+            break;
+        next = (const char *)memchr(next, '\n', end - next);
+        if (!next || next + 1 >= end)
+            break;
+        bounds.push_back(next + 1);
+    }
+    bounds.push_back(end);
+    return true;
+}
+
+// Calls parseRun(r) for every run on `threads` threads; several runs per
+// thread let idle threads steal work
+static void parseRuns(size_t runCount, int threads, const function<void(size_t)> &parseRun)
+{
+    auto parseRange = [&](size_t first, size_t last)
+    {
+        for (size_t r = first; r < last; r++)
+        {
+            parseRun(r);
+        }
+    };
+    if (runCount > 1 && threads != 1)
+    {
+        WorkStealingPool pool(threads);
+        pool.parallelFor(runCount, 1, parseRange);
+    }
+    else
+    {
+        parseRange(0, runCount);
+    }
+}
+
+static void reportBadRows(const string &filename, size_t badRows)
+{
+    if (badRows > 0)
+    {
+        cerr << "Error: Skipped " << badRows << " malformed rows in " << filename << endl;
+    }
+}
+
+// Emails parsed from one run of rows, in file order
+struct EmailRows
+{
+    const vector<string> &headerWords;
+    vector<EmailData> spam;
+    vector<EmailData> ham;
+    vector<string> words;
+    size_t badRows = 0;
+
+    EmailRows(const vector<string> &header) : headerWords(header) {}
+
+    void count(size_t column, int n)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            words.push_back(headerWords[column]);
+        }
+    }
+
+    void endRow(int label)
+    {
+        if (label == 1)
+            spam.emplace_back("spam", std::move(words));
+        else
+            ham.emplace_back("ham", std::move(words));
+        words.clear();
+    }
+
+    void dropRow() { words.clear(); }
+};
+
+// Function to read the entire dataset and separate into spam and ham
+bool readEntireDataset(const string &filename, const vector<string> &headerWords,
+                       vector<EmailData> &allSpam, vector<EmailData> &allHam, int threads)
+{
+    MappedFile file;
+    vector<const char *> bounds;
+    if (!mapRuns(filename, file, bounds))
+        return false;
+
+    vector<EmailRows> runs;
+    runs.reserve(bounds.size() - 1);
+    for (size_t r = 0; r + 1 < bounds.size(); r++)
+    {
+        runs.emplace_back(headerWords);
+    }
+    parseRuns(runs.size(), threads, [&](size_t r)
+    {
+        runs[r].badRows = scanRows(bounds[r], bounds[r + 1], headerWords.size(), runs[r]);
+    });
+
+    size_t badRows = 0;
+    for (EmailRows &run : runs)
+    {
+        allSpam.insert(allSpam.end(), make_move_iterator(run.spam.begin()), make_move_iterator(run.spam.end()));
+        allHam.insert(allHam.end(), make_move_iterator(run.ham.begin()), make_move_iterator(run.ham.end()));
+        badRows += run.badRows;
+    }
+    reportBadRows(filename, badRows);
+    return true;
+}
+
+// One run of rows of a SparseCorpus; emailEnds are relative to the run
+struct SparseRows
+{
+    const vector<uint32_t> &columnIds;
+    vector<WordCount> counts;
+    vector<size_t> emailEnds;
+    vector<char> labels;
+    size_t rowStart = 0;
+    size_t badRows = 0;
+
+    SparseRows(const vector<uint32_t> &ids) : columnIds(ids) {}
+
+    void count(size_t column, int n)
+    {
+        WordCount wc = {columnIds[column], (uint32_t)n};
+        counts.push_back(wc);
+    }
+
+    void endRow(int label)
+    {
+        rowStart = counts.size();
+        emailEnds.push_back(rowStart);
+        labels.push_back(label == 1);
+    }
+
+    void dropRow() { counts.resize(rowStart); }
+};
+
+// Function to read the entire dataset into a sparse corpus
+bool readSparseDataset(const string &filename, const vector<string> &headerWords,
+                       SparseCorpus &corpus, int threads)
+{
+    corpus.clear();
+
+    // Interning: columns that repeat a word share its id
+    unordered_map<string, uint32_t> wordIds;
+    vector<uint32_t> columnIds;
+    columnIds.reserve(headerWords.size());
+    for (const string &word : headerWords)
+    {
+        auto inserted = wordIds.insert(make_pair(word, (uint32_t)corpus.vocabulary.size()));
+        if (inserted.second)
+            corpus.vocabulary.push_back(word);
+        columnIds.push_back(inserted.first->second);
+    }
+
+    MappedFile file;
+    vector<const char *> bounds;
+    if (!mapRuns(filename, file, bounds))
+        return false;
+
+    vector<SparseRows> runs;
+    runs.reserve(bounds.size() - 1);
+    for (size_t r = 0; r + 1 < bounds.size(); r++)
+    {
+        runs.emplace_back(columnIds);
+    }
+    parseRuns(runs.size(), threads, [&](size_t r)
+    {
+        runs[r].badRows = scanRows(bounds[r], bounds[r + 1], columnIds.size(), runs[r]);
+    });
+
+    size_t totalCounts = 0, totalEmails = 0, badRows = 0;
+    for (const SparseRows &run : runs)
+    {
+        totalCounts += run.counts.size();
+        totalEmails += run.labels.size();
+    }
+    corpus.counts.reserve(totalCounts);
+    corpus.emailStarts.reserve(totalEmails + 1);
+    corpus.labels.reserve(totalEmails);
+    for (SparseRows &run : runs)
+    {
+        size_t offset = corpus.counts.size();
+        for (size_t end : run.emailEnds)
+        {
+            corpus.emailStarts.push_back(offset + end);
+        }
+        corpus.counts.insert(corpus.counts.end(), run.counts.begin(), run.counts.end());
+        corpus.labels.insert(corpus.labels.end(), run.labels.begin(), run.labels.end());
+        badRows += run.badRows;
+        vector<WordCount>().swap(run.counts);
+    }
+    reportBadRows(filename, badRows);
+    return true;
+}
+
+// Spam and ham totals per column for the rows one worker has scanned
+struct TrainingRows
+{
+    vector<double> spam;
+    vector<double> ham;
+    vector<pair<size_t, int>> row;      // (column, count) of the row being scanned
+    size_t badRows = 0;
+
+    TrainingRows(size_t columns) : spam(columns, 0.0), ham(columns, 0.0) {}
+
+    void count(size_t column, int n) { row.emplace_back(column, n); }
+
+    void endRow(int label)
+    {
+        vector<double> &totals = label == 1 ? spam : ham;
+        for (const pair<size_t, int> &cell : row)
+        {
+            totals[cell.first] += cell.second;
+        }
+        row.clear();
+    }
+
+    void dropRow() { row.clear(); }
+};
+
+// Function to count spam and ham word frequencies over the entire dataset
+bool trainWordFrequencies(const string &filename, const vector<string> &headerWords,
+                          vector<WordFreq> &model, int threads)
+{
+    MappedFile file;
+    vector<const char *> bounds;
+    if (!mapRuns(filename, file, bounds))
+        return false;
+
+    size_t runCount = bounds.size() - 1;
+    size_t columns = headerWords.size();
+    vector<TrainingRows> workers;
+    if (runCount > 1 && threads != 1)
+    {
+        WorkStealingPool pool(threads);
+        workers.assign(pool.getThreadCount(), TrainingRows(columns));
+        pool.parallelForWorker(runCount, 1, [&](int worker, size_t first, size_t last)
+        {
+            for (size_t r = first; r < last; r++)
+            {
+                workers[worker].badRows += scanRows(bounds[r], bounds[r + 1], columns, workers[worker]);
+            }
+        });
+
+        // Reduce: each chunk of columns is summed into worker 0's totals
+        pool.parallelFor(columns, 1024, [&](size_t begin, size_t end)
+        {
+            for (size_t w = 1; w < workers.size(); w++)
+            {
+                for (size_t c = begin; c < end; c++)
+                {
+                    workers[0].spam[c] += workers[w].spam[c];
+                    workers[0].ham[c] += workers[w].ham[c];
+                }
+            }
+        });
+        for (size_t w = 1; w < workers.size(); w++)
+        {
+            workers[0].badRows += workers[w].badRows;
+        }
+    }
+    else
+    {
+        workers.assign(1, TrainingRows(columns));
+        for (size_t r = 0; r < runCount; r++)
+        {
+            workers[0].badRows += scanRows(bounds[r], bounds[r + 1], columns, workers[0]);
+        }
+    }
+
+    const TrainingRows &totals = workers[0];
+    model.clear();
+    unordered_map<string, size_t> positions;
+    for (size_t c = 0; c < columns; c++)
+    {
+        if (headerWords[c].empty())
+            continue;
+        auto inserted = positions.insert(make_pair(headerWords[c], model.size()));
+        if (inserted.second)
+            model.push_back(WordFreq(headerWords[c], 0.0, 0.0));
+        WordFreq &wordFreq = model[inserted.first->second];
+        wordFreq.addCounts(totals.spam[c], totals.ham[c]);
+    }
+    reportBadRows(filename, totals.badRows);
+    return true;
+}
@@ -0,0 +1,38 @@
+#ifndef READCSV_H
+#define READCSV_H
+
+#include "hashmap.h"
+#include "corpus.h"
+
+// One labelled email: ("spam" or "ham", its words)
+typedef pair<string, vector<string>> EmailData;
+
+// Function to read the header (row of words present) and return the list of words
+vector<string> readHeader(const string &filename);
+
+// Function to read the entire dataset and separate into spam and ham.
+// The file is memory-mapped and split into runs of whole rows that are
+// parsed on `threads` threads (0 = one per hardware thread); emails keep
+// their file order. Returns false if the file could not be read.
+bool readEntireDataset(const string &filename, const vector<string> &headerWords,
+                       vector<EmailData> &allSpam, vector<EmailData> &allHam, int threads = 0);
+
+// Reads the dataset into a SparseCorpus: the header words are interned into
+// its vocabulary and each email keeps one (wordId, count) pair per non-zero
+// column instead of count copies of the word. Parsed like readEntireDataset.
+bool readSparseDataset(const string &filename, const vector<string> &headerWords,
+                       SparseCorpus &corpus, int threads = 0);
+
+// Trains the model straight from the dataset. The rows are streamed on
+// `threads` threads, each adding the counts of its rows to its own spam and
+// ham totals per column, and the per-thread totals are summed at the end.
+// model gets one WordFreq per distinct header word in header order; columns
+// that repeat a word are added together.
+bool trainWordFrequencies(const string &filename, const vector<string> &headerWords,
+                          vector<WordFreq> &model, int threads = 0);
+
+// The original getline / stoi reader, kept to check the fast one against
+void readEntireDatasetStream(const string &filename, const vector<string> &headerWords,
+                             vector<EmailData> &allSpam, vector<EmailData> &allHam);
+
+#endif
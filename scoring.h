@@ -0,0 +1,119 @@
+#ifndef SCORING_H
+#define SCORING_H
+
+#include "classifier.h"
+#include "readCSV.h"
+#include "threadpool.h"
+
+// Scores whole corpora (for example allSpam / allHam from readEntireDataset)
+// on a WorkStealingPool. All threads read the same model, which must not be
+// modified while scoring runs. verdicts[i] is the verdict for emails[i].
+template <class Map>
+class ParallelScorer {
+private:
+    BasicEmailClassifier<Map> classifier;
+    WorkStealingPool& pool;
+    size_t chunkSize;
+
+public:
+    ParallelScorer(Map* map, WorkStealingPool& workers, double thresh = 0.7, size_t emailsPerChunk = 64)
+        : classifier(map, thresh), pool(workers), chunkSize(emailsPerChunk) {}
+
+    // Shared by every worker thread; see BasicEmailClassifier::setStats
+    void setStats(ClassifierStats* stats) { classifier.setStats(stats); }
+
+    // verdicts is a vector<char> rather than vector<bool> so that threads can
+    // write neighbouring entries without sharing bits of one word
+    void score(const vector<EmailData>& emails, vector<char>& verdicts) {
+        verdicts.assign(emails.size(), 0);
+        pool.parallelFor(emails.size(), chunkSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                verdicts[i] = classifier.classify(emails[i].second);
+            }
+        });
+    }
+
+    void score(const SparseCorpus& corpus, vector<char>& verdicts) {
+        verdicts.assign(corpus.size(), 0);
+        pool.parallelFor(corpus.size(), chunkSize, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                verdicts[i] = classifier.classify(corpus, i);
+            }
+        });
+    }
+
+    // Emails stored back to back in one token stream, as for classifyBatch;
+    // each chunk of emails is scored with classifyBatch
+    void score(const vector<string_view>& tokens, const vector<size_t>& emailEnds, vector<char>& verdicts) {
+        verdicts.assign(emailEnds.size(), 0);
+        pool.parallelFor(emailEnds.size(), chunkSize, [&](size_t begin, size_t end) {
+            size_t firstToken = begin == 0 ? 0 : emailEnds[begin - 1];
+            vector<string_view> chunkTokens(tokens.begin() + firstToken, tokens.begin() + emailEnds[end - 1]);
+            vector<size_t> chunkEnds;
+            chunkEnds.reserve(end - begin);
+            for (size_t i = begin; i < end; i++) {
+                chunkEnds.push_back(emailEnds[i] - firstToken);
+            }
+            vector<bool> chunkVerdicts;
+            classifier.classifyBatch(chunkTokens, chunkEnds, chunkVerdicts);
+            for (size_t i = begin; i < end; i++) {
+                verdicts[i] = chunkVerdicts[i - begin];
+            }
+        });
+    }
+};
+
+// How a model does on a labelled corpus, and how far its scores are from a
+// baseline model's on the same emails
+struct AccuracyReport {
+    size_t emails;
+    size_t correct;
+    size_t falsePositives;          //ham classified as spam
+    size_t falseNegatives;          //spam classified as ham
+    size_t flips;                   //verdicts that differ from the baseline's
+    double maxScoreDelta;           //largest |score - baseline score|
+
+    AccuracyReport() : emails(0), correct(0), falsePositives(0), falseNegatives(0), flips(0), maxScoreDelta(0) {}
+
+    double accuracy() const { return emails ? (double)correct / emails : 0.0; }
+};
+
+// Scores every email of corpus into scores and compares the verdicts with
+// the labels and, when baselineScores is given, with the baseline's verdicts
+template <class Map>
+AccuracyReport measureAccuracy(Map* map, const SparseCorpus& corpus, double thresh, vector<double>& scores,
+                               const vector<double>* baselineScores = nullptr) {
+    BasicEmailClassifier<Map> classifier(map, thresh);
+    auto isSpamScore = [&](double score) {
+        return score >= 0 && score >= thresh;
+    };
+
+    AccuracyReport report;
+    scores.resize(corpus.size());
+    for (size_t i = 0; i < corpus.size(); i++) {
+        scores[i] = classifier.score(corpus, i);
+        bool spam = isSpamScore(scores[i]);
+        report.emails++;
+        report.correct += spam == (bool)corpus.labels[i];
+        report.falsePositives += spam && !corpus.labels[i];
+        report.falseNegatives += !spam && corpus.labels[i];
+        if (baselineScores) {
+            double baseline = (*baselineScores)[i];
+            report.flips += spam != isSpamScore(baseline);
+            report.maxScoreDelta = max(report.maxScoreDelta, fabs(scores[i] - baseline));
+        }
+    }
+    return report;
+}
+
+inline void printAccuracyReport(ostream& out, const string& name, const AccuracyReport& report, const AccuracyReport* baseline = nullptr) {
+    out << name << ": accuracy " << report.accuracy() * 100 << "% (" << report.correct << " of " << report.emails
+        << "), " << report.falsePositives << " false positives, " << report.falseNegatives << " false negatives";
+    if (baseline) {
+        out << ", delta " << (report.accuracy() - baseline->accuracy()) * 100 << " points, " << report.flips
+            << " verdicts flipped, max score delta " << report.maxScoreDelta;
+    }
+    out << endl;
+}
+
+#endif
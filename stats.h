@@ -0,0 +1,235 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Shape of one hash table. The maps fill it in by walking their buckets when
+// asked (getStats), so nothing is counted on the insert or lookup paths.
+// While a map is part way through a resize, entries not yet moved are counted
+// where they are in the old table.
+struct TableStats {
+    size_t buckets;                 //buckets or slots, in every table being walked
+    size_t words;
+    size_t usedBuckets;             //buckets holding at least one word, or full slots
+    size_t tombstones;              //slots of deleted words; none of the maps delete yet
+    vector<size_t> chainLengths;    //chainLengths[n] = buckets holding n words (chaining maps only)
+    vector<size_t> probeLengths;    //probeLengths[n] = words found on the n-th probe
+
+    TableStats() : buckets(0), words(0), usedBuckets(0), tombstones(0) {}
+
+    // Words per bucket; for the chaining maps this is the average chain length
+    double loadFactor() const { return buckets ? (double)words / buckets : 0.0; }
+    double occupancy() const { return buckets ? (double)usedBuckets / buckets : 0.0; }
+    double tombstoneRatio() const { return buckets ? (double)tombstones / buckets : 0.0; }
+
+    size_t maxProbe() const { return probeLengths.empty() ? 0 : probeLengths.size() - 1; }
+
+    double averageProbe() const {
+        size_t found = 0, probes = 0;
+        for (size_t n = 0; n < probeLengths.size(); n++) {
+            found += probeLengths[n];
+            probes += n * probeLengths[n];
+        }
+        return found ? (double)probes / found : 0.0;
+    }
+};
+
+inline void addToHistogram(vector<size_t>& histogram, size_t value) {
+    if (histogram.size() <= value) {
+        histogram.resize(value + 1, 0);
+    }
+    histogram[value]++;
+}
+
+inline void printHistogram(ostream& out, const char* name, const vector<size_t>& histogram) {
+    out << "  " << name << ":";
+    for (size_t n = 0; n < histogram.size(); n++) {
+        if (histogram[n]) {
+            out << " " << n << "=" << histogram[n];
+        }
+    }
+    out << endl;
+}
+
+inline void printTableStats(ostream& out, const string& name, const TableStats& stats) {
+    out << name << ": " << stats.words << " words in " << stats.buckets << " buckets, load factor "
+        << stats.loadFactor() << ", " << stats.occupancy() * 100 << "% of buckets used, tombstones "
+        << stats.tombstoneRatio() * 100 << "%" << endl;
+    if (!stats.chainLengths.empty()) {
+        printHistogram(out, "chain lengths", stats.chainLengths);
+    }
+    out << "  probes: max " << stats.maxProbe() << ", average " << stats.averageProbe() << endl;
+    printHistogram(out, "probe lengths", stats.probeLengths);
+}
+
+// Counts of values in nanoseconds, exact below 16 and otherwise in eight
+// buckets per power of two, so a percentile read from it is within 12.5%.
+// Adding a value is one relaxed atomic increment.
+class LatencyHistogram {
+public:
+    enum { EXACT = 16, SUB_BUCKETS = 8, BUCKETS = EXACT + 60 * SUB_BUCKETS };
+
+private:
+    atomic<uint64_t> counts[BUCKETS];
+
+    static int bucketFor(uint64_t nanos) {
+        if (nanos < EXACT) {
+            return (int)nanos;
+        }
+        int exponent = 63;
+        while (!(nanos >> exponent)) {
+            exponent--;
+        }
+        int sub = (int)(nanos >> (exponent - 3)) & (SUB_BUCKETS - 1);
+        return EXACT + (exponent - 4) * SUB_BUCKETS + sub;
+    }
+
+    // Largest value that falls into bucket
+    static uint64_t upperBound(int bucket) {
+        if (bucket < EXACT) {
+            return (uint64_t)bucket;
+        }
+        int exponent = (bucket - EXACT) / SUB_BUCKETS + 4;
+        uint64_t sub = (uint64_t)((bucket - EXACT) % SUB_BUCKETS);
+        return ((SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
+    }
+
+public:
+    LatencyHistogram() {
+        clear();
+    }
+
+    void add(uint64_t nanos, uint64_t times = 1) {
+        counts[bucketFor(nanos)].fetch_add(times, memory_order_relaxed);
+    }
+
+    // Smallest bucket bound that at least `fraction` of the values fall under
+    uint64_t percentile(double fraction) const {
+        uint64_t total = 0;
+        for (const atomic<uint64_t>& count : counts) {
+            total += count.load(memory_order_relaxed);
+        }
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t target = (uint64_t)(fraction * total);
+        if (target == 0) {
+            target = 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i].load(memory_order_relaxed);
+            if (seen >= target) {
+                return upperBound(i);
+            }
+        }
+        return upperBound(BUCKETS - 1);
+    }
+
+    void clear() {
+        for (atomic<uint64_t>& count : counts) {
+            count.store(0, memory_order_relaxed);
+        }
+    }
+};
+
+struct ClassifierSummary {
+    uint64_t calls;                 //classify or classifyBatch calls
+    uint64_t emails;
+    uint64_t tokens;                //words looked up, counting repeats
+    uint64_t hits;                  //of those, words the model knows
+    uint64_t spam;                  //emails classified as spam
+    uint64_t p50Nanos;              //latency per email
+    uint64_t p99Nanos;
+    uint64_t maxNanos;
+};
+
+// What a classifier has done since it was given these stats. Each call adds
+// a handful of relaxed atomic increments and two clock reads, so the stats
+// can stay on in production; several classifiers and threads may share one.
+// A batch counts as one call and adds its average latency once per email.
+class ClassifierStats {
+private:
+    atomic<uint64_t> calls;
+    atomic<uint64_t> emails;
+    atomic<uint64_t> tokens;
+    atomic<uint64_t> hits;
+    atomic<uint64_t> spam;
+    atomic<uint64_t> maxNanos;
+    LatencyHistogram latency;
+
+public:
+    ClassifierStats() {
+        clear();
+    }
+
+    ClassifierStats(const ClassifierStats&) = delete;
+    ClassifierStats& operator=(const ClassifierStats&) = delete;
+
+    static chrono::steady_clock::time_point now() {
+        return chrono::steady_clock::now();
+    }
+
+    void record(chrono::steady_clock::time_point start, uint64_t emailCount, uint64_t tokenCount,
+                uint64_t hitCount, uint64_t spamCount) {
+        if (emailCount == 0) {
+            return;
+        }
+        uint64_t elapsed = (uint64_t)chrono::duration_cast<chrono::nanoseconds>(now() - start).count();
+        uint64_t perEmail = elapsed / emailCount;
+
+        calls.fetch_add(1, memory_order_relaxed);
+        emails.fetch_add(emailCount, memory_order_relaxed);
+        tokens.fetch_add(tokenCount, memory_order_relaxed);
+        hits.fetch_add(hitCount, memory_order_relaxed);
+        spam.fetch_add(spamCount, memory_order_relaxed);
+        latency.add(perEmail, emailCount);
+
+        uint64_t currentMax = maxNanos.load(memory_order_relaxed);
+        while (perEmail > currentMax && !maxNanos.compare_exchange_weak(currentMax, perEmail, memory_order_relaxed)) {
+        }
+    }
+
+    ClassifierSummary summary() const {
+        ClassifierSummary s;
+        s.calls = calls.load(memory_order_relaxed);
+        s.emails = emails.load(memory_order_relaxed);
+        s.tokens = tokens.load(memory_order_relaxed);
+        s.hits = hits.load(memory_order_relaxed);
+        s.spam = spam.load(memory_order_relaxed);
+        s.maxNanos = maxNanos.load(memory_order_relaxed);
+        // Bucket bounds can overshoot the largest value actually seen
+        s.p50Nanos = min(latency.percentile(0.5), s.maxNanos);
+        s.p99Nanos = min(latency.percentile(0.99), s.maxNanos);
+        return s;
+    }
+
+    void print(ostream& out, const string& name) const {
+        ClassifierSummary s = summary();
+        out << name << ": " << s.emails << " emails in " << s.calls << " calls, " << s.spam << " spam, "
+            << s.tokens << " tokens (" << s.hits << " hits, " << s.tokens - s.hits << " misses)" << endl;
+        out << "  latency per email: p50 " << s.p50Nanos << " ns, p99 " << s.p99Nanos << " ns, max "
+            << s.maxNanos << " ns" << endl;
+    }
+
+    // Not atomic as a whole; counts recorded meanwhile may be partly kept
+    void clear() {
+        calls = 0;
+        emails = 0;
+        tokens = 0;
+        hits = 0;
+        spam = 0;
+        maxNanos = 0;
+        latency.clear();
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include "hashmap.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Fixed set of worker threads that run parallel loops. Each worker owns a
+// queue of chunks and works through it from the front; a worker whose queue
+// is empty steals chunks from the back of the others' queues, so a thread
+// that drew slow emails does not hold up the rest.
+class WorkStealingPool {
+private:
+    struct Chunk {
+        size_t begin;
+        size_t end;
+    };
+
+    struct WorkerQueue {
+        mutex lock;
+        deque<Chunk> chunks;
+    };
+
+    vector<thread> workers;
+    vector<unique_ptr<WorkerQueue>> queues;
+
+    mutex jobLock;
+    condition_variable jobReady;
+    condition_variable jobDone;
+    const function<void(int, size_t, size_t)>* job;     //loop body of the running parallelFor
+    unsigned jobGeneration;
+    size_t chunksLeft;
+    int activeWorkers;          //workers still inside the running job
+    bool stopping;
+
+    bool takeChunk(int worker, Chunk& chunk) {
+        {
+            WorkerQueue& own = *queues[worker];
+            lock_guard<mutex> guard(own.lock);
+            if (!own.chunks.empty()) {
+                chunk = own.chunks.front();
+                own.chunks.pop_front();
+                return true;
+            }
+        }
+        for (size_t i = 1; i < queues.size(); i++) {
+            WorkerQueue& victim = *queues[(worker + i) % queues.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.chunks.empty()) {
+                chunk = victim.chunks.back();
+                victim.chunks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int worker) {
+        unsigned seenGeneration = 0;
+        while (true) {
+            const function<void(int, size_t, size_t)>* body;
+            {
+                unique_lock<mutex> guard(jobLock);
+                jobReady.wait(guard, [&]() { return stopping || jobGeneration != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = jobGeneration;
+                body = job;
+                if (!body) {
+                    continue;       //woke after that job had already finished
+                }
+                activeWorkers++;
+            }
+
+            Chunk chunk;
+            size_t finished = 0;
+            while (takeChunk(worker, chunk)) {
+                (*body)(worker, chunk.begin, chunk.end);
+                finished++;
+            }
+
+            lock_guard<mutex> guard(jobLock);
+            chunksLeft -= finished;
+            activeWorkers--;
+            if (chunksLeft == 0 && activeWorkers == 0) {
+                jobDone.notify_all();
+            }
+        }
+    }
+
+public:
+    WorkStealingPool(int threads = 0) : job(nullptr), jobGeneration(0), chunksLeft(0), activeWorkers(0), stopping(false) {
+        if (threads <= 0) {
+            threads = max(1, (int)thread::hardware_concurrency());
+        }
+        for (int i = 0; i < threads; i++) {
+            queues.push_back(unique_ptr<WorkerQueue>(new WorkerQueue()));
+        }
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(thread(&WorkStealingPool::workerLoop, this, i));
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            lock_guard<mutex> guard(jobLock);
+            stopping = true;
+        }
+        jobReady.notify_all();
+        for (thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    int getThreadCount() const { return (int)workers.size(); }
+
+    // Runs body(begin, end) over [0, count) in chunks of chunkSize and returns
+    // once every chunk is done. Chunks are dealt out to the workers in
+    // contiguous runs, so a worker that never steals reads memory in order.
+    // Only one parallelFor may run at a time.
+    void parallelFor(size_t count, size_t chunkSize, const function<void(size_t, size_t)>& body) {
+        parallelForWorker(count, chunkSize, [&](int, size_t begin, size_t end) {
+            body(begin, end);
+        });
+    }
+
+    // Like parallelFor, but body(worker, begin, end) is also told which worker
+    // (0 to getThreadCount() - 1) runs the chunk, so it can keep per-thread
+    // state without locking. One worker never runs two chunks at once.
+    void parallelForWorker(size_t count, size_t chunkSize, const function<void(int, size_t, size_t)>& body) {
+        if (count == 0) {
+            return;
+        }
+        chunkSize = max<size_t>(chunkSize, 1);
+        size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+        size_t perWorker = (chunkCount + queues.size() - 1) / queues.size();
+
+        for (size_t c = 0; c < chunkCount; c++) {
+            Chunk chunk = {c * chunkSize, min(count, (c + 1) * chunkSize)};
+            WorkerQueue& queue = *queues[c / perWorker];
+            lock_guard<mutex> guard(queue.lock);
+            queue.chunks.push_back(chunk);
+        }
+
+        unique_lock<mutex> guard(jobLock);
+        job = &body;
+        chunksLeft = chunkCount;
+        jobGeneration++;
+        jobReady.notify_all();
+        // Waiting for the workers too means none of them can still be looping
+        // over this job when the next parallelFor fills the queues
+        jobDone.wait(guard, [&]() { return chunksLeft == 0 && activeWorkers == 0; });
+        job = nullptr;
+    }
+};
+
+#endif
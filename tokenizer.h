@@ -0,0 +1,93 @@
+#ifndef TOKENIZER_H
+#define TOKENIZER_H
+
+#include "hashmap.h"
+
+// Splits email text into words in one pass over the buffer. The text is
+// lowercased in place and every byte that is not a letter, digit or part of
+// a UTF-8 sequence separates words, so "FREE!!" and "free" give the same
+// token. Tokens are views into the buffer, nothing is copied.
+//
+// With SSE2 the buffer is handled 16 bytes at a time: the bytes are
+// lowercased and classified with a few vector compares, and the word
+// boundaries are read off the resulting bit mask.
+
+inline bool isWordByte(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+// Calls onToken(string_view) for every word in text[0, length)
+template <class OnToken>
+void tokenizeInPlace(char* text, size_t length, OnToken&& onToken) {
+    size_t tokenStart = 0;
+    bool inWord = false;
+    size_t pos = 0;
+
+#ifdef HASHMAP_USE_SSE2
+    const __m128i beforeUpper = _mm_set1_epi8('A' - 1), afterUpper = _mm_set1_epi8('Z' + 1);
+    const __m128i beforeLower = _mm_set1_epi8('a' - 1), afterLower = _mm_set1_epi8('z' + 1);
+    const __m128i beforeDigit = _mm_set1_epi8('0' - 1), afterDigit = _mm_set1_epi8('9' + 1);
+    const __m128i caseBit = _mm_set1_epi8(0x20), zero = _mm_setzero_si128();
+
+    for (; pos + 16 <= length; pos += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)(text + pos));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, beforeUpper), _mm_cmplt_epi8(bytes, afterUpper));
+        bytes = _mm_or_si128(bytes, _mm_and_si128(upper, caseBit));
+        _mm_storeu_si128((__m128i*)(text + pos), bytes);
+
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(bytes, beforeLower), _mm_cmplt_epi8(bytes, afterLower));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(bytes, beforeDigit), _mm_cmplt_epi8(bytes, afterDigit));
+        __m128i multiByte = _mm_cmplt_epi8(bytes, zero);
+        uint32_t wordMask = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(letter, digit), multiByte));
+
+        // A word starts where a word byte follows a separator and ends at the
+        // first separator after a word byte
+        uint32_t previous = (wordMask << 1) | (inWord ? 1u : 0u);
+        uint32_t starts = wordMask & ~previous;
+        uint32_t ends = ~wordMask & previous & 0xffff;
+        uint32_t boundaries = starts | ends;
+        while (boundaries) {
+            int bit = lowestSetBit(boundaries);
+            if (starts & (1u << bit)) {
+                tokenStart = pos + bit;
+            }
+            else {
+                onToken(string_view(text + tokenStart, pos + bit - tokenStart));
+            }
+            boundaries &= boundaries - 1;
+        }
+        inWord = (wordMask >> 15) & 1;
+    }
+#endif
+
+    for (; pos < length; pos++) {
+        unsigned char c = (unsigned char)text[pos];
+        if (c >= 'A' && c <= 'Z') {
+            c += 'a' - 'A';
+            text[pos] = (char)c;
+        }
+        if (isWordByte(c)) {
+            if (!inWord) {
+                tokenStart = pos;
+                inWord = true;
+            }
+        }
+        else if (inWord) {
+            onToken(string_view(text + tokenStart, pos - tokenStart));
+            inWord = false;
+        }
+    }
+    if (inWord) {
+        onToken(string_view(text + tokenStart, length - tokenStart));
+    }
+}
+
+// Replaces tokens with the words of text; the views point into text
+inline void tokenizeInPlace(string& text, vector<string_view>& tokens) {
+    tokens.clear();
+    tokenizeInPlace(&text[0], text.size(), [&](string_view token) {
+        tokens.push_back(token);
+    });
+}
+
+#endif
@@ -0,0 +1,35 @@
+#include "compiledmodel.h"
+#include "readCSV.h"
+#include <cstdlib>
+
+// Model trainer: counts how often every word occurs in the spam and in the
+// ham emails of the per-email dataset and writes the frequencies as the
+// transposed CSV, or as a compiled model when the output ends in ".model".
+//   train [dataset.csv] [output.csv|output.model] [threads]
+int main(int argc, char *argv[]) {
+    string datasetFile = argc > 1 ? argv[1] : "emails.csv";
+    string outputFile = argc > 2 ? argv[2] : "final.csv";
+    int threads = argc > 3 ? atoi(argv[3]) : 0;
+
+    // The last header column is the label, not a word
+    vector<string> headerWords = readHeader(datasetFile);
+    if (headerWords.empty()) {
+        cerr << "Error: No header in " << datasetFile << endl;
+        return 1;
+    }
+    headerWords.pop_back();
+
+    vector<WordFreq> model;
+    if (!trainWordFrequencies(datasetFile, headerWords, model, threads)) {
+        return 1;
+    }
+
+    bool binary = outputFile.size() >= 6 && outputFile.compare(outputFile.size() - 6, 6, ".model") == 0;
+    bool written = binary ? compileModel(model, outputFile) : writeWordFrequenciesToTransposedCSV(outputFile, model);
+    if (!written) {
+        cerr << "Failed to write " << outputFile << endl;
+        return 1;
+    }
+    cout << "Trained " << model.size() << " words from " << datasetFile << " into " << outputFile << endl;
+    return 0;
+}
@@ -0,0 +1,362 @@
+#ifndef WORDAUTOMATON_H
+#define WORDAUTOMATON_H
+
+#include "hashmap.h"
+#include "tokenizer.h"
+#include <algorithm>
+#include <unordered_map>
+
+// The model vocabulary compiled into a DFA that reads raw email text. The
+// tokenizer's rules are folded into the byte-to-symbol table: uppercase
+// letters share the symbol of their lowercase letter and every byte the
+// tokenizer treats as a separator is SEPARATOR. So one pass over the text
+// finds the word boundaries and walks the trie at the same time, with no
+// token vector, no hashing and no second look at the bytes of a word.
+//
+// The trie is a double array: a state's child on symbol c sits at slot
+// base + c, and it is really its child if that slot's check is the state.
+// A step is one load of an 8-byte slot, the whole array for final.csv is
+// about 50 KB, and the text is only read, never lowercased in place.
+//
+// insert() stages words and the automaton is rebuilt before it is next
+// used; call finishRehash() after the last insert (the CSV loader does)
+// before several threads read it. There is nothing to hash, so
+// it is not a HashMap; like the compiled model it is used through the
+// classifier template.
+class WordAutomaton {
+private:
+    enum { SEPARATOR = 0, FREE = -1, DEAD = -1, NO_WORD = -1 };
+
+    struct Slot {
+        int32_t base;
+        int32_t check;      //parent state, or FREE
+    };
+
+    vector<Slot> slots;                 //slot 0 is the root, "between words"
+    vector<int32_t> wordAt;             //id of the word ending at a state, or NO_WORD
+    uint16_t exactSymbol[256];          //byte as stored in the model
+    uint16_t scanSymbol[256];           //byte as the tokenizer would see it
+    vector<WordFreq> words;             //by id
+
+    enum { MAX_MISFITS = 16 };
+
+    // Free slots while building, as a circular list in index order
+    vector<int32_t> nextFree, prevFree;     //-1 once a slot has left the list
+    vector<uint8_t> misfits;                //failed bases tried on the slot
+    int32_t freeHead;
+
+    vector<WordFreq> pending;           //all words while the automaton is stale
+    unordered_map<string, size_t> pendingIndex;
+    bool stale;
+
+    // A slot's array index as a state; fits since the vocabulary does
+    static int32_t state(size_t slot) { return (int32_t)slot; }
+
+    void growTo(size_t size) {
+        size_t oldSize = slots.size();
+        if (oldSize >= size) {
+            return;
+        }
+        slots.resize(size, Slot{0, FREE});
+        wordAt.resize(size, NO_WORD);
+        nextFree.resize(size);
+        prevFree.resize(size);
+        misfits.resize(size, 0);
+        for (size_t i = oldSize; i < size; i++) {
+            int32_t slot = state(i);
+            if (freeHead < 0) {
+                freeHead = nextFree[slot] = prevFree[slot] = slot;
+                continue;
+            }
+            int32_t last = prevFree[freeHead];
+            nextFree[last] = slot;
+            prevFree[slot] = last;
+            nextFree[slot] = freeHead;
+            prevFree[freeHead] = slot;
+        }
+    }
+
+    void unlinkFree(int32_t slot) {
+        if (nextFree[slot] < 0) {
+            return;
+        }
+        if (nextFree[slot] == slot) {
+            freeHead = -1;
+        }
+        else {
+            nextFree[prevFree[slot]] = nextFree[slot];
+            prevFree[nextFree[slot]] = prevFree[slot];
+            if (freeHead == slot) {
+                freeHead = nextFree[slot];
+            }
+        }
+        nextFree[slot] = prevFree[slot] = -1;
+    }
+
+    void take(int32_t slot, int32_t parent) {
+        slots[slot].check = parent;
+        unlinkFree(slot);
+    }
+
+    // First base at least 1 that puts every symbol on a free slot. Only
+    // bases that put the first symbol on a free slot are tried, so the
+    // filled part of the array is skipped; past the last free slot the
+    // array grows and the new slots always fit. A free slot that has failed
+    // MAX_MISFITS times leaves the list, as in darts-clone, or the holes of
+    // the dense front of the array make the build quadratic; it can still be
+    // used for a symbol other than the first.
+    int32_t findBase(const vector<uint16_t>& symbols) {
+        if (freeHead < 0) {
+            growTo(slots.size() + symbols.back() + 1);
+        }
+        int32_t slot = freeHead;
+        for (;;) {
+            if (slot > symbols[0]) {
+                size_t base = slot - symbols[0];
+                growTo(base + symbols.back() + 1);
+                bool fits = true;
+                for (uint16_t symbol : symbols) {
+                    if (slots[base + symbol].check != FREE) {
+                        fits = false;
+                        break;
+                    }
+                }
+                if (fits) {
+                    return state(base);
+                }
+            }
+            int32_t next = nextFree[slot];
+            if (++misfits[slot] >= MAX_MISFITS) {
+                unlinkFree(slot);
+            }
+            if (freeHead < 0 || next == freeHead || next == slot) {
+                next = state(slots.size());
+                growTo(slots.size() + symbols.back() + 1);
+            }
+            slot = next;
+        }
+    }
+
+    void build() {
+        slots.clear();
+        wordAt.clear();
+        nextFree.clear();
+        prevFree.clear();
+        misfits.clear();
+        freeHead = -1;
+
+        // Symbols 1..symbolCount for the bytes the vocabulary uses; the byte
+        // no word uses gets noSymbol, which no state has a child on
+        bool used[256] = {};
+        for (const WordFreq& wf : words) {
+            for (unsigned char c : wf.word) {
+                used[c] = true;
+            }
+        }
+        uint16_t symbolCount = 0;
+        for (int c = 0; c < 256; c++) {
+            exactSymbol[c] = used[c] ? ++symbolCount : 0;
+        }
+        uint16_t noSymbol = symbolCount + 1;
+        for (int c = 0; c < 256; c++) {
+            if (!exactSymbol[c]) {
+                exactSymbol[c] = noSymbol;
+            }
+            unsigned char folded = (unsigned char)(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+            scanSymbol[c] = isWordByte(folded) ? exactSymbol[folded] : (uint16_t)SEPARATOR;
+        }
+
+        // Words sorted by their bytes, so every state's words are one range
+        // and its children are the runs of equal bytes at its depth
+        vector<int32_t> order(words.size());
+        for (size_t i = 0; i < words.size(); i++) {
+            order[i] = (int32_t)i;
+        }
+        sort(order.begin(), order.end(), [&](int32_t a, int32_t b) {
+            return words[a].word < words[b].word;
+        });
+
+        struct Pending {
+            size_t begin, end;      //range of order
+            size_t depth;
+            int32_t state;
+        };
+        growTo(noSymbol + 2);
+        take(0, -2);                //no state's child
+        vector<Pending> queue = {{0, order.size(), 0, 0}};
+        vector<uint16_t> symbols;
+        vector<size_t> runStarts;
+        for (size_t next = 0; next < queue.size(); next++) {
+            Pending p = queue[next];
+            if (p.begin < p.end && words[order[p.begin]].word.size() == p.depth) {
+                wordAt[p.state] = order[p.begin];
+                p.begin++;
+            }
+            if (p.begin == p.end) {
+                continue;
+            }
+
+            symbols.clear();
+            runStarts.clear();
+            for (size_t i = p.begin; i < p.end; i++) {
+                uint16_t symbol = exactSymbol[(unsigned char)words[order[i]].word[p.depth]];
+                if (symbols.empty() || symbols.back() != symbol) {
+                    symbols.push_back(symbol);
+                    runStarts.push_back(i);
+                }
+            }
+            runStarts.push_back(p.end);
+
+            int32_t base = findBase(symbols);
+            slots[p.state].base = base;
+            for (size_t s = 0; s < symbols.size(); s++) {
+                int32_t child = base + symbols[s];
+                take(child, p.state);
+                queue.push_back({runStarts[s], runStarts[s + 1], p.depth + 1, state(child)});
+            }
+        }
+        // Room for base + noSymbol of every state, so scanning needs no bounds check
+        int32_t maxBase = 0;
+        for (const Slot& slot : slots) {
+            maxBase = max(maxBase, slot.base);
+        }
+        growTo(maxBase + noSymbol + 1);
+        nextFree = vector<int32_t>();
+        prevFree = vector<int32_t>();
+        misfits = vector<uint8_t>();
+    }
+
+    void rebuild() {
+        words.swap(pending);
+        pending.clear();
+        pendingIndex.clear();
+        stale = false;
+        build();
+    }
+
+public:
+    // s is only a hint for how many words will be inserted
+    WordAutomaton(int s = 997) : freeHead(-1), stale(false) {
+        pending.reserve(s);
+        build();
+    }
+
+    WordAutomaton(const WordAutomaton&) = delete;
+    WordAutomaton& operator=(const WordAutomaton&) = delete;
+
+    void insert(WordFreq data) {
+        if (!stale) {
+            WordFreq* existing = search(data.word);
+            if (existing) {
+                *existing = data;
+                return;
+            }
+            pending.swap(words);
+            for (size_t i = 0; i < pending.size(); i++) {
+                pendingIndex.emplace(pending[i].word, i);
+            }
+            stale = true;
+        }
+        auto found = pendingIndex.find(data.word);
+        if (found != pendingIndex.end()) {
+            pending[found->second] = data;
+            return;
+        }
+        pendingIndex.emplace(data.word, pending.size());
+        pending.push_back(data);
+    }
+
+    void finishRehash() {
+        if (stale) {
+            rebuild();
+        }
+    }
+
+    // Exact bytes, like the maps: no case folding and no separators
+    WordFreq* search(string_view key) {
+        finishRehash();
+        int32_t current = 0;
+        for (unsigned char c : key) {
+            int32_t next = slots[current].base + exactSymbol[c];
+            if (slots[next].check != current) {
+                return nullptr;
+            }
+            current = next;
+        }
+        int32_t id = wordAt[current];
+        return id == NO_WORD ? nullptr : &words[id];
+    }
+
+    // The classifier's batch path hashes ahead and prefetches; there is
+    // nothing to hash, and the trie's top levels stay in cache anyway
+    uint64_t hashCode(string_view) const { return 0; }
+    void prefetch(uint64_t) const {}
+    void prefetchEntry(uint64_t) const {}
+    WordFreq* searchHashed(string_view key, uint64_t) { return search(key); }
+
+    // Calls onWord(const WordFreq*) for every word of text[0, length), in
+    // order, as tokenizeInPlace would split it: the model's entry for the
+    // word (its id is getId), or nullptr when the model does not know it
+    template <class OnWord>
+    void scanText(const char* text, size_t length, OnWord&& onWord) {
+        finishRehash();
+        const Slot* array = slots.data();
+        int32_t current = 0;
+        for (size_t pos = 0; pos < length; pos++) {
+            uint16_t symbol = scanSymbol[(unsigned char)text[pos]];
+            if (symbol == SEPARATOR) {
+                if (current != 0) {
+                    int32_t id = current == DEAD ? NO_WORD : wordAt[current];
+                    onWord(id == NO_WORD ? nullptr : &words[id]);
+                    current = 0;
+                }
+            }
+            else if (current != DEAD) {
+                int32_t next = array[current].base + symbol;
+                current = array[next].check == current ? next : DEAD;
+            }
+        }
+        if (current != 0) {
+            int32_t id = current == DEAD ? NO_WORD : wordAt[current];
+            onWord(id == NO_WORD ? nullptr : &words[id]);
+        }
+    }
+
+    int32_t getId(const WordFreq* word) const { return (int32_t)(word - words.data()); }
+
+    int getCount() const { return (int)(stale ? pending.size() : words.size()); }
+
+    // Slots of the double array; the probe histogram counts the steps taken
+    // to find each word, which is its length
+    TableStats getStats() {
+        finishRehash();
+        TableStats stats;
+        stats.buckets = slots.size();
+        stats.words = words.size();
+        for (const Slot& slot : slots) {
+            stats.usedBuckets += slot.check != FREE;
+        }
+        for (const WordFreq& wf : words) {
+            addToHistogram(stats.probeLengths, wf.word.size());
+        }
+        return stats;
+    }
+
+    size_t getBytes() const { return slots.size() * sizeof(Slot) + wordAt.size() * sizeof(int32_t); }
+
+    void clear() {
+        words.clear();
+        pending.clear();
+        pendingIndex.clear();
+        stale = false;
+        build();
+    }
+};
+
+// Reads the text once through the automaton and leaves it as it is
+template <class OnWord>
+void forEachModelWord(WordAutomaton* automaton, char* text, size_t length, OnWord&& onWord) {
+    automaton->scanText(text, length, onWord);
+}
+
+#endif